@@ -12,83 +12,43 @@
 #include <vector>
 #include <thread>
 #include <memory>
+#include <atomic>
+#include <algorithm>
+#include <fstream>
+#include <csignal>
 
-#if defined(__linux__) && defined(USE_CPU_AFFINITY)
-#include <pthread.h>
+#if defined(__linux__)
+#include <sys/wait.h>
 #endif
 
+#include "sieve_common.h"
+#include "segmented_sieve.h"
+#include "range_sieve.h"
+#include "bucket_sieve.h"
+#include "batch_sieve.h"
+#include "distributed_sieve.h"
+#include "extendable_sieve.h"
+#include "word_sieve.h"
+#include "wheel_sieve.h"
+#include "fixed_sieve.h"
+#include "atkin_sieve.h"
+#include "linear_sieve.h"
+#include "pritchard_sieve.h"
+#include "prime_writer.h"
+#include "worker_pool.h"
+#include "pass_telemetry.h"
+#include "perf_profile.h"
+#include "tune_config.h"
+#include "bench_harness.h"
+#include "page_buffer.h"
+#include "sieve_file.h"
+#include "prime_query.h"
+
 using namespace std;
 using namespace std::chrono;
 
 const uint64_t DEFAULT_UPPER_LIMIT = 10'000'000LLU;
 
-const double baseline[] = {
-163,
-317,
-415,
-518,
-623,
-734,
-835,
-947,
-1051,
-1140,
-1235,
-1325,
-1428,
-1499,
-1607,
-2144,
-2238,
-2338,
-2474,
-2581,
-2690,
-2796,
-2871,
-2949,
-3011,
-3115,
-3204,
-3255,
-3320,
-3281,
-3176,
-2968,
-3007,
-3062,
-3124,
-3176,
-3222,
-3276,
-3336,
-3402,
-3471,
-3519,
-3568,
-3621,
-3673,
-3741,
-3791,
-3841,
-3899,
-3945,
-3995,
-4053,
-4105,
-4164,
-4215,
-4260,
-4304,
-4357,
-4401,
-4455,
-4485,
-4538,
-4565,
-4562
-};
-
 #define prime(bit) ((bit<<1)+1)
 #define bit(prime) ((prime-1)>>1)
 
@@ -101,15 +61,24 @@ class prime_sieve
 {
   protected:
 
-      vector<bool> Bits;                                        // Sieve data, where 1==prime, 0==not
+      vector<bool, page_allocator<bool>> Bits;                  // Sieve data, where 1==prime, 0==not
       uint64_t limit;
    public:
 
-      prime_sieve(uint64_t n) : Bits((n>>1)-1, true)                  // Initialize all to true (potential primes)
+      prime_sieve(uint64_t n) : Bits(n>>1, true)                      // Initialize all to true (potential primes)
       {
           limit = n;
       }
 
+      // reset
+      //
+      // Marks everything as a potential prime again, keeping the storage, so the sieve can be run again.
+
+      void reset()
+      {
+          Bits.assign(Bits.size(), true);
+      }
+
       ~prime_sieve()
       {
       }
@@ -125,12 +94,10 @@ class prime_sieve
           uint64_t factor = 1;
           uint64_t q = (int) sqrt(Bits.size());
 
-          int64_t timings[1024];
+          // With --profile the primes below SMALL_STRIDE_LIMIT and the rest are reported as separate phases
+          profile_phase phase(PHASE_SMALL_PRIMES);
+          bool bLargePrimes = false;
 
-#ifdef PROFILE
-          int timingCounter = 0;
-          auto tStart       = steady_clock::now();
-#endif
           while (factor <= q)
           {
               for (uint64_t num = factor; num < Bits.size(); num++)
@@ -141,6 +108,11 @@ class prime_sieve
                       break;
                   }
               }
+              if (!bLargePrimes && prime(factor) >= SMALL_STRIDE_LIMIT)
+              {
+                  phase.switchTo(PHASE_LARGE_PRIMES);
+                  bLargePrimes = true;
+              }
               // the starting number is supposed to be factor squared, but since the factor is scaled and
               // shifted we need some maths here...
               // n = (factor*2)+1
@@ -151,23 +123,7 @@ class prime_sieve
                   Bits[num] = false;
 
               factor++;
-#ifdef PROFILE
-              auto tEnd = steady_clock::now();
-              timings[timingCounter++ % 1024] = duration_cast<microseconds>(tEnd-tStart).count();
-              tStart = tEnd;   
-#endif
           }
-#ifdef PROFILE
-          if(timingCounter < 1024) {
-              for(int i=0; i<timingCounter; i++) {
-                  cout << i << ": " << timings[i] << endl;
-              }
-          } else {
-              for(int i=timingCounter-1024; i<timingCounter; i++) {
-                  cout << i << ": " << timings[i % 1024] << endl;
-              }
-          }
-#endif
       }
 
       // countPrimes
@@ -176,7 +132,7 @@ class prime_sieve
 
       size_t countPrimes() const
       {
-          size_t count = (Bits.size() >= 1);                   // Count 2 as prime if within range
+          size_t count = (limit > 2);                          // Count 2 as prime if within range
           for (int i = 1; i < Bits.size(); i++)
               if (Bits[i])
                   count++;
@@ -189,10 +145,11 @@ class prime_sieve
 
       bool isPrime(uint64_t n) const
       {
-          if (n & 1)
-              return Bits[(n-1)>>1];
-          else
+          if (n == 2)
+              return limit > 2;
+          if (!(n & 1) || n == 1 || n >= limit)
               return false;
+          return Bits[n>>1];
       }
 
       // validateResults
@@ -202,22 +159,7 @@ class prime_sieve
 
       bool validateResults() const
       {
-          const std::map<const uint64_t, const int> resultsDictionary =
-          {
-                {             10LLU, 4         },               // Historical data for validating our results - the number of primes
-                {            100LLU, 25        },               // to be found under some limit, such as 168 primes under 1000
-                {          1'000LLU, 168       },
-                {         10'000LLU, 1229      },
-                {        100'000LLU, 9592      },
-                {      1'000'000LLU, 78498     },
-                {     10'000'000LLU, 664579    },
-                {    100'000'000LLU, 5761455   },
-                {  1'000'000'000LLU, 50847534  },
-                { 10'000'000'000LLU, 455052511 },
-          };
-          if (resultsDictionary.end() == resultsDictionary.find(limit))
-              return false;
-          return resultsDictionary.find(limit)->second == countPrimes();
+          return validatePrimeCount(limit, countPrimes());
       }
 
       // printResults
@@ -226,22 +168,19 @@ class prime_sieve
 
       void printResults(bool showResults, double duration, size_t passes, size_t threads) const
       {
-          if (showResults)
-              cout << "2, ";
+          // Count once and reuse it for validation: every pass over vector<bool> goes bit by bit
+          size_t count = countPrimes();
 
-          size_t count = (Bits.size() >= 1);                   // Count 2 as prime if in range
-          for (uint64_t num = 1; num <= Bits.size(); num++)
+          if (showResults)
           {
-              if (Bits[num])
-              {
-                  if (showResults)
-                      cout << ((num<<1)+1) << ", ";
-                  count++;
-              }
+              prime_writer writer;
+              if (limit > 2)
+                  writer.put(2);
+              for (uint64_t num = 1; num < Bits.size(); num++)
+                  if (Bits[num])
+                      writer.put((num<<1)+1);
+              writer.finish();
           }
-
-          if (showResults)
-              cout << "\n";
           
           cout << "Passes: "  << passes << ", "
                << "Threads: " << threads << ", "
@@ -249,95 +188,243 @@ class prime_sieve
                << "Average: " << duration/passes << ", "
                << "Per second: " << passes/duration << ", "
                << "Limit: "   << limit << ", "
-               << "Counts: "  << count << "/" << countPrimes() << ", "
-               << "Valid : "  << (validateResults() ? "Pass" : "FAIL!") 
+               << "Count: "   << count << ", "
+               << "Valid : "  << (validatePrimeCount(limit, count) ? "Pass" : "FAIL!") 
                << "\n";
       }
 };
 
 // doing the sieve in tranches trying to optimize cache usage
-// tranche size must be < 18769 (33rd prime squared) 
-class prime_sieve_tranches: public prime_sieve {
+// every sieving prime up to sqrt(limit) remembers the next multiple it has to cross off, so the whole bitmap
+// is processed one cache-sized tranche at a time.  tranche_size is in bits and has no upper bound; by default
+// it matches the L1 data cache as reported by sysfs, which measured best for the single-threaded runs.
+class prime_sieve_tranches: public prime_sieve_words {
     protected:
-        uint16_t primes[32]; // store the first 32 primes here
-        uint64_t counters[32];
-        uint16_t tranche_size;
-        uint16_t cnt = 0;
+        vector<uint64_t> primes;   // sieving primes found so far (beyond the pre-sieve pattern)
+        vector<uint64_t> counters; // bit index of the next multiple of each of them
+        uint64_t tranche_size;
     public:
-        prime_sieve_tranches(uint64_t n, uint16_t tranche_size) : prime_sieve(n), tranche_size(tranche_size) {
+        static uint64_t defaultTrancheSize() {
+            return cacheSizeBytes(1) * 8;
         }
 
-        void runSieve()
-        {
-            // split the sieve in 3:
-            // part 1: do the first tranche_size numbers, collect primes
-            // part 2: do all other tranches, do all primes in each tranche before moving on to next tranche
-            // part 3: do the rest of the primes
+        prime_sieve_tranches(uint64_t n, uint64_t tranche_size = defaultTrancheSize())
+          : prime_sieve_words(n, false),
+            tranche_size(max<uint64_t>(64, tranche_size & ~63ULL)) {   // whole words, so a fill never splits one
+        }
 
-            // the Bits-array only contains values for odd numbers. The actual number n for index i is (i*2)+1
-            uint64_t factor = 1; // this represents the prime "3", but we only store odd numbers
+        // runSieve initializes each tranche as it gets to it, so there is nothing to reset
+        void reset() {
+        }
 
-            // part 1
-            while(cnt < 32) {
-                for(uint64_t bit = factor; bit < tranche_size; bit++) {
-                    if(Bits[bit]) {
-                        factor = bit;
-                        break;
+        void runSieve()
+        {
+            // for each tranche:
+            // part 1: fill it with the pre-sieve pattern
+            // part 2: cross off every sieving prime we know of, and remember where each one stopped
+            // part 3: until we have them all, scan the tranche for new sieving primes (p*p < limit).  a new
+            //         prime's own multiples within the tranche are crossed off at once, so any composite
+            //         further along is gone before the scan reaches it
+
+            // the Words-array only contains values for odd numbers. The actual number n for index i is (i*2)+1
+            uint64_t factor = presieve_pattern::get().firstSievingBit();
+            bool bAllPrimes = false;
+
+            primes.clear();
+            counters.clear();
+
+            for(uint64_t tranche = 0; tranche < cBits; tranche += tranche_size) {
+                uint64_t end = min(cBits, tranche + tranche_size);
+
+                // part 1
+                profile_phase phase(PHASE_INIT);
+                initializeWords(tranche >> 6, (end + 63) >> 6);
+
+                // part 2
+                phase.switchTo(PHASE_SMALL_PRIMES);
+                for(size_t i = 0; i < primes.size(); i++) {
+                    uint64_t p = primes[i];
+                    if (p >= SMALL_STRIDE_LIMIT && (i == 0 || primes[i - 1] < SMALL_STRIDE_LIMIT))
+                        phase.switchTo(PHASE_LARGE_PRIMES);
+                    uint64_t num = counters[i];
+                    if (num < end) {
+                        crossOff(&Words[0], p, num, end);
+                        num += (end - num + p - 1) / p * p;
                     }
+                    counters[i] = num;
                 }
-                uint64_t last_counter = 0;
-                uint64_t bit;
-                for (bit = 2*factor*(factor + 1); bit < tranche_size; bit += (factor<<1)+1) {
-                    Bits[bit] = false;
-                }
-                primes[cnt] = (uint16_t)factor;
-                counters[cnt] = bit;
-                cnt++;
-                factor++;
-            }
 
-            // at this point factor == prime no 33 + 1
-            // part 2
-            for(uint64_t tranche = tranche_size; tranche<Bits.size(); tranche += tranche_size) {
-                for(int i=0; i<cnt; i++) {
-                    uint64_t f = primes[i];
-                    uint64_t num;
-                    uint64_t end = min(Bits.size(), tranche+tranche_size);
-                    for (num = counters[i]; num < end; num += (f<<1)+1) {
-                        Bits[num] = false;
+                // part 3
+                phase.switchTo(PHASE_SIEVE);
+                for(uint64_t w = factor >> 6; !bAllPrimes && w < ((end + 63) >> 6); w++) {
+                    uint64_t bits = Words[w] & (~0ULL << (factor & 63));
+                    for(; bits; bits &= bits - 1) {
+                        factor = (w << 6) + __builtin_ctzll(bits);
+                        // the starting number is supposed to be factor squared, but since the factor is scaled
+                        // and shifted: n = (factor*2)+1 => (n^2-1)/2 = 2 * factor * (factor + 1)
+                        uint64_t num = 2*factor*(factor + 1);
+                        if (num >= cBits) {
+                            bAllPrimes = true;
+                            break;
+                        }
+                        uint64_t p = (factor<<1)+1;
+                        if (num < end) {
+                            crossOff(&Words[0], p, num, end);
+                            num += (end - num + p - 1) / p * p;
+                            bits &= Words[w];                   // p may have crossed off later bits of this word
+                        }
+                        primes.push_back(p);
+                        counters.push_back(num);
                     }
-                    counters[i] = num;
+                    factor = (w + 1) << 6;
                 }
             }
+        }
+};
+
+// engineName
+//
+// The name an engine goes by in tune files, benchmark records and baselines.
+
+inline string engineName(const prime_sieve *)          { return "basic"; }
+inline string engineName(const prime_sieve_words *)    { return "words"; }
+inline string engineName(const prime_sieve_tranches *) { return "tranches"; }
+inline string engineName(const prime_sieve_atkin *)     { return "atkin"; }
+inline string engineName(const prime_sieve_linear *)    { return "linear"; }
+inline string engineName(const prime_sieve_pritchard *) { return "pritchard"; }
+
+template <uint32_t W>
+inline string engineName(const prime_sieve_wheel<W> *) { return "wheel" + to_string(W); }
+
+template <uint64_t Limit>
+inline string engineName(const prime_sieve_fixed<Limit> *) { return "fixed"; }
+
+// printQuietSpeed
+//
+// The --quiet line for one run: its key (thread count or tranche size), passes per second and, when a
+// baseline was loaded with --compare-baseline, the percentage relative to the matching baseline median.
+
+void printQuietSpeed(uint64_t key, double speed, const string &engine, uint64_t llUpperLimit, unsigned int cThreads) {
+    cout << key << ", " << speed;
+    const bench_record *record = benchmark_baseline::get().find(engine, llUpperLimit, cThreads);
+    if (record && record->stats.median > 0)
+        cout << ", " << int((speed / record->stats.median - 1) * 100);
+    cout << endl;
+}
+
+// printPageReport
+//
+// The page size the most recent sieve buffer actually got.  Called while the check sieve is still alive.
+
+void printPageReport() {
+    cout << "Pages: " << page_report::get().describe() << endl;
+}
+
+// runIndependentPasses
+//
+// Keeps every thread of the pool running sieves of type Sieve back to back until runTime has passed, and
+// returns how many were completed in total.  The passes are counted in pass_telemetry, one padded counter
+// per thread; this thread is the timer, and with --live it also prints the progress reports.  With --profile
+// each pass is split into phases for perf_profile.h and the run's report is written at the end.
+
+template <typename Sieve>
+uint64_t runIndependentPasses(worker_pool &pool, uint64_t llUpperLimit, duration<double> runTime) {
+    double liveInterval = run_options::get().liveInterval;
+    pass_telemetry telemetry(pool.size(), liveInterval > 0);
+    profile_session &profile = profile_session::get();
+    atomic<bool> bStop(false);
+
+    // The arenas are per thread, so a buffer cached on one would sit beside those the others allocate: this
+    // thread's cache goes before the workers start, and theirs once they are done
+    buffer_arena::local().release();
+
+    profile.start();
+
+    auto tStart = steady_clock::now();
+
+    pool.start([&](unsigned int i)
+    {
+        // Each sieve is created on the heap, rather than the stack, due to its possible enormity.  By using
+        // a unique_ptr it will automatically free resources as soon as its torn down.  With --reuse the
+        // thread keeps a single sieve and resets it between passes.  The clock is only read per pass when
+        // the latencies are being recorded.
+
+        auto tPass = telemetry.recordsLatency() ? steady_clock::now() : steady_clock::time_point();
+        auto recordPass = [&]()
+        {
+            if (!telemetry.recordsLatency())
+                return telemetry.recordPass(i);
+            auto tEnd = steady_clock::now();
+            telemetry.recordPass(i, tEnd - tPass);
+            tPass = tEnd;
+        };
+
+        // With --profile every pass also counts its primes, so that the count phase gets measured too
+        volatile size_t cFound = 0;
+        auto runPass = [&](Sieve &sieve)
+        {
+            {
+                profile_phase phase(PHASE_SIEVE);
+                sieve.runSieve();
+            }
+            if (profile.active())
+            {
+                profile_phase phase(PHASE_COUNT);
+                cFound = sieve.countPrimes();
+            }
+            recordPass();
+        };
 
-            // part 3
-            uint64_t q = (int) sqrt(Bits.size());
-            while (factor <= q)
+        if (run_options::get().bReuseSieves)
+        {
+            std::unique_ptr<Sieve> sieve;
+            {
+                profile_phase phase(PHASE_INIT);
+                sieve.reset(new Sieve(llUpperLimit));
+            }
+            for (bool bFirst = true; !bStop.load(memory_order_relaxed); bFirst = false)
             {
-                for (uint64_t num = factor; num < Bits.size(); num++)
+                if (!bFirst)
                 {
-                    if (Bits[num])
-                    {
-                        factor = num;
-                        break;
-                    }
+                    profile_phase phase(PHASE_INIT);
+                    sieve->reset();
                 }
-                // the starting number is supposed to be factor squared, but since the factor is scaled and
-                // shifted we need some maths here...
-                // n = (factor*2)+1
-                // => n^2 = 4*factor^2 + 4*factor + 1
-                // scaling back, subtract one and divide by 2: 2*factor^2 + 2*factor = 2 * factor * (factor + 1)
-                // each jump is also scaled
-                for (uint64_t num = 2*factor*(factor + 1); num < Bits.size(); num += (factor<<1)+1)
-                    Bits[num] = false;
-
-                factor++;
+                runPass(*sieve);
             }
         }
-};
+        else
+        {
+            while (!bStop.load(memory_order_relaxed))
+            {
+                std::unique_ptr<Sieve> sieve;
+                {
+                    profile_phase phase(PHASE_INIT);
+                    sieve.reset(new Sieve(llUpperLimit));
+                }
+                runPass(*sieve);
+            }
+        }
+    });
+
+    telemetry.runTimer(tStart, tStart + duration_cast<steady_clock::duration>(runTime), bStop, liveInterval);
+    pool.wait();
+
+    double elapsed = duration<double>(steady_clock::now() - tStart).count();
+    if (liveInterval > 0)
+        telemetry.printTotal(elapsed);
+    profile.finish(engineName((Sieve *) nullptr), llUpperLimit, pool.size(), telemetry.totalPasses(), elapsed);
+
+    pool.run([](unsigned int) { buffer_arena::local().release(); });
+    return telemetry.totalPasses();
+}
 
+// runSieveThreads
+//
+// Runs independent sieves of type Sieve (prime_sieve or prime_sieve_words) on every thread for cSeconds.
+
+template <typename Sieve>
 int runSieveThreads(int cSeconds, int cThreads, uint64_t llUpperLimit, bool bQuiet, bool bPrintPrimes) {
-    auto cPasses      = 0;
+    uint64_t cPasses  = 0;
 
     if (!bQuiet)
     {
@@ -350,74 +437,42 @@ int runSieveThreads(int cSeconds, int cThreads, uint64_t llUpperLimit, bool bQui
         );
     }
 
-    auto tStart       = steady_clock::now();
-
-
-    while (duration_cast<seconds>(steady_clock::now() - tStart).count() < cSeconds)
-    {
-        vector<thread> threadPool;
-        
-        // We create N threads and give them each the job of runing the 'runSieve' method on a sieve
-        // that we create on the heap, rather than the stack, due to their possible enormity.  By using
-        // a unique_ptr it will automatically free resources as soon as its torn down.
-
-        for (unsigned int i = 0; i < cThreads; i++) {
-            threadPool.push_back(thread([llUpperLimit] 
-            { 
-                std::unique_ptr<prime_sieve>(new prime_sieve(llUpperLimit))->runSieve(); 
-            }));
-#ifdef USE_CPU_AFFINITY
-            // https://stackoverflow.com/questions/24645880/set-cpu-affinity-when-create-a-thread
-            cpu_set_t cpuset;
-            CPU_ZERO(&cpuset);
-            // move the first bit of the counter last ==> pin all the even cpu-s first, then the odd
-            // (this might give better cache performance if cpuid 2n and 2n+1 shares cache).
-            // this formula only works as expected with 32 cores and 64 threads (6 bits of cpu numbers)
-            // moving bit 4 to position 1 and bit 5 to position 0
-            unsigned int cpunum = ((i & 15) << 2) | ((i & 16) >> 3) | ((i & 32) >> 5); 
-            CPU_SET(cpunum, &cpuset);
-            int rc = pthread_setaffinity_np(threadPool.back().native_handle(), sizeof(cpu_set_t), &cpuset);
-            if(rc != 0) {
-                std::cerr << "Error setting thread affinity on thread " << i << ", error code: " << rc << endl;
-            }
-#endif
-        }
+    // The worker threads are created (and pinned) once, before the clock starts.  Each of them keeps running
+    // its own sieves back to back until the main thread raises the stop flag at the deadline.
 
-        // Now we wait for all of the threads to finish before we repeat
+    worker_pool pool(cThreads);
+    if (!bQuiet && pool.pinned())
+        cout << "Affinity " << pool.describePlacement() << endl;
 
-        for (auto &th : threadPool) 
-            th.join();
+    memory_snapshot memoryStart;
+    auto tStart       = steady_clock::now();
 
-        // Credit us with one pass for each of the threads we did work on
-        cPasses += cThreads;
-    }
+    cPasses = runIndependentPasses<Sieve>(pool, llUpperLimit, seconds(cSeconds));
+    memory_snapshot memoryEnd;
 
     auto tEnd = steady_clock::now() - tStart;
     auto duration = duration_cast<microseconds>(tEnd).count()/1000000.0;
     
-    prime_sieve checkSieve(llUpperLimit);
+    Sieve checkSieve(llUpperLimit);
     checkSieve.runSieve();
     auto result = checkSieve.validateResults() ? checkSieve.countPrimes() : 0;
   
-    if (!bQuiet)
+    if (!bQuiet) {
         checkSieve.printResults(bPrintPrimes, duration , cPasses, cThreads);
-    else {
-        double b = baseline[cThreads-1];
-        double speed = cPasses / duration;
-        cout << cThreads << ", " << speed << ", " << int((speed/b-1)*100) << endl;
-        //cout << cThreads << ", " << cPasses / duration << ", " << cPasses << ", " << duration / cPasses << endl;
-
-    }
+        printPageReport();
+        cout << memoryEnd.describeSince(memoryStart, cPasses) << endl;
+    } else
+        printQuietSpeed(cThreads, cPasses / duration, engineName((Sieve *) nullptr), llUpperLimit, cThreads);
 
     return result;
 }
 
-int runSieveTranche(int cSeconds, uint16_t cTrancheSize, uint64_t llUpperLimit, bool bQuiet, bool bPrintPrimes) {
+int runSieveTranche(int cSeconds, uint64_t cTrancheSize, uint64_t llUpperLimit, bool bQuiet, bool bPrintPrimes) {
     auto cPasses      = 0;
 
     if (!bQuiet)
     {
-        printf("Computing primes to %lu with tranches of size %d for %d second%s.\n", 
+        printf("Computing primes to %lu with tranches of size %lu for %d second%s.\n", 
             llUpperLimit,
             cTrancheSize,
             cSeconds,
@@ -425,155 +480,1869 @@ int runSieveTranche(int cSeconds, uint16_t cTrancheSize, uint64_t llUpperLimit,
         );
     }
 
+    memory_snapshot memoryStart;
     auto tStart       = steady_clock::now();
 
+    // The sieve is created on the heap, rather than the stack, due to its possible enormity.  By using a
+    // unique_ptr it will automatically free resources as soon as its torn down.  With --reuse we keep the
+    // one sieve for all passes.  With --profile the tranches report their own phases, and each pass also
+    // counts its primes so that the count phase gets measured.
+
+    profile_session &profile = profile_session::get();
+    profile.start();
 
+    std::unique_ptr<prime_sieve_tranches> sieve;
     while (duration_cast<seconds>(steady_clock::now() - tStart).count() < cSeconds)
     {
-        vector<thread> threadPool;
-        
-        // We create N threads and give them each the job of runing the 'runSieve' method on a sieve
-        // that we create on the heap, rather than the stack, due to their possible enormity.  By using
-        // a unique_ptr it will automatically free resources as soon as its torn down.
-
-        std::unique_ptr<prime_sieve_tranches>(new prime_sieve_tranches(llUpperLimit, cTrancheSize))->runSieve(); 
-        // Credit us with one pass for each of the threads we did work on
+        {
+            profile_phase phase(PHASE_INIT);
+            if (!run_options::get().bReuseSieves)
+                sieve.reset();
+            if (sieve)
+                sieve->reset();
+            else
+                sieve.reset(new prime_sieve_tranches(llUpperLimit, cTrancheSize));
+        }
+        sieve->runSieve();
+        if (profile.active())
+        {
+            profile_phase phase(PHASE_COUNT);
+            volatile size_t cFound = sieve->countPrimes();
+            (void) cFound;
+        }
         cPasses++;
     }
+    sieve.reset();
+    memory_snapshot memoryEnd;
 
     auto tEnd = steady_clock::now() - tStart;
     auto duration = duration_cast<microseconds>(tEnd).count()/1000000.0;
+    profile.finish("tranches", llUpperLimit, 1, cPasses, duration);
     
-    prime_sieve checkSieve(llUpperLimit);
+    prime_sieve_tranches checkSieve(llUpperLimit, cTrancheSize);
     checkSieve.runSieve();
     auto result = checkSieve.validateResults() ? checkSieve.countPrimes() : 0;
   
-    if (!bQuiet)
+    if (!bQuiet) {
         checkSieve.printResults(bPrintPrimes, duration , cPasses, 1);
-    else {
-        double b = baseline[0];
-        double speed = cPasses / duration;
-        cout << cTrancheSize << ", " << speed << ", " << int((speed/b-1)*100) << endl;
-        //cout << cThreads << ", " << cPasses / duration << ", " << cPasses << ", " << duration / cPasses << endl;
+        printPageReport();
+        cout << memoryEnd.describeSince(memoryStart, cPasses) << endl;
+    } else
+        printQuietSpeed(cTrancheSize, cPasses / duration, "tranches", llUpperLimit, 1);
 
-    }
+    return result;
+}
+
+// profileOneshotCount
+//
+// With --profile a oneshot run counts its primes once inside the count phase, so that its report has that
+// phase like the timed runs' do.
+
+template <typename Sieve>
+void profileOneshotCount(Sieve &sieve) {
+    if (!profile_session::get().active())
+        return;
+    profile_phase phase(PHASE_COUNT);
+    volatile size_t cFound = sieve.countPrimes();
+    (void) cFound;
+}
+
+// runTrancheMode
+//
+// Oneshot or timed runs of the tranche engine, which always runs on one thread.
 
+int runTrancheMode(bool bOneshot, bool bQuiet, int cSeconds, uint64_t cTrancheSize, uint64_t llUpperLimit, bool bPrintPrimes) {
+    if(!bOneshot)
+        return runSieveTranche(cSeconds, cTrancheSize, llUpperLimit, bQuiet, bPrintPrimes);
+
+    // With --profile the tranches report their own phases, as in runSieveTranche
+    profile_session &profile = profile_session::get();
+    profile.start();
+
+    auto tStart = steady_clock::now();
+    std::unique_ptr<prime_sieve_tranches> checkSieve;
+    {
+        profile_phase phase(PHASE_INIT);
+        checkSieve.reset(new prime_sieve_tranches(llUpperLimit, cTrancheSize));
+    }
+    checkSieve->runSieve();
+    auto duration = duration_cast<microseconds>(steady_clock::now() - tStart).count()/1000000.0;
+    profileOneshotCount(*checkSieve);
+    profile.finish("tranches", llUpperLimit, 1, 1, duration);
+
+    auto result = checkSieve->validateResults() ? checkSieve->countPrimes() : 0;
+    checkSieve->printResults(bPrintPrimes, duration, 1, 1);
+    printPageReport();
     return result;
 }
-int main(int argc, char **argv)
-{
-    vector<string> args(argv + 1, argv + argc);         // From first to last argument in the argv array
-    uint64_t ullLimitRequested = 0;
-    auto cThreadsRequested = 0;
-    auto cSecondsRequested = 0;
-    auto cTrancheSize      = 0;
-    auto bPrintPrimes      = false;
-    auto bOneshot          = false;
-    auto bQuiet            = false;
 
-    // Process command-line args
+// runSieveOneshot
+//
+// A single sieve on the calling thread, timed and reported.
 
-    for (auto i = args.begin(); i != args.end(); ++i) 
+template <typename Sieve>
+int runSieveOneshot(uint64_t llUpperLimit, bool bPrintPrimes) {
+    profile_session &profile = profile_session::get();
+    profile.start();
+
+    auto tStart = steady_clock::now();
+    std::unique_ptr<Sieve> checkSieve;
     {
-        if (*i == "-h" || *i == "--help") {
-              cout << "Syntax: " << argv[0] << " [-t,--threads threads] [-s,--seconds seconds] [-l,--limit limit] [-1,--oneshot] [-q,--quiet] [-h] " << endl;
-#ifdef USE_CPU_AFFINITY
-              cout << "Compiled with CPU affinity" << endl;
-#endif
-            return 0;
-        }
-        else if (*i == "-t" || *i == "--threads") 
-        {
-            i++;
-            cThreadsRequested = (i == args.end()) ? 0 : max(1, atoi(i->c_str()));
-        }
-        else if (*i == "-r" || *i == "--tranches") 
-        {
-            i++;
-            cTrancheSize = (i == args.end()) ? 0 : max(1, atoi(i->c_str()));
+        profile_phase phase(PHASE_INIT);
+        checkSieve.reset(new Sieve(llUpperLimit));
+    }
+    {
+        profile_phase phase(PHASE_SIEVE);
+        checkSieve->runSieve();
+    }
+    auto duration = duration_cast<microseconds>(steady_clock::now() - tStart).count()/1000000.0;
+    profileOneshotCount(*checkSieve);
+    profile.finish(engineName((Sieve *) nullptr), llUpperLimit, 1, 1, duration);
+
+    auto result = checkSieve->validateResults() ? checkSieve->countPrimes() : 0;
+    checkSieve->printResults(bPrintPrimes, duration, 1, 1);
+    printPageReport();
+    return result;
+}
+
+// runSieveMode
+//
+// Oneshot, timed or (with --quiet) a sweep over 1..cThreads threads for one sieve type.
+
+template <typename Sieve>
+int runSieveMode(bool bOneshot, bool bQuiet, int cSeconds, int cThreads, uint64_t llUpperLimit, bool bPrintPrimes) {
+    int result = 0;
+    if(!bQuiet) {
+        if(bOneshot) {
+            result = runSieveOneshot<Sieve>(llUpperLimit, bPrintPrimes);
+        } else {
+            result = runSieveThreads<Sieve>(cSeconds, cThreads, llUpperLimit, bQuiet, bPrintPrimes);
         }
-        else if (*i == "-s" || *i == "--seconds") 
-        {
-            i++;
-            cSecondsRequested = (i == args.end()) ? 0 : max(1, atoi(i->c_str()));
+    } else {
+        for(int i=1; i<=cThreads; i++) {
+            result = runSieveThreads<Sieve>(cSeconds, i, llUpperLimit, bQuiet, bPrintPrimes);
         }
-        else if (*i == "-l" || *i == "--limit") 
+    }
+    return result;
+}
+
+// runFixedMode
+//
+// Runs the prime_sieve_fixed instantiation for llUpperLimit, or the word sieve when the limit isn't one of
+// the benchmark limits it is compiled for.
+
+int runFixedMode(bool bOneshot, bool bQuiet, int cSeconds, int cThreads, uint64_t llUpperLimit, bool bPrintPrimes) {
+    if (!bQuiet && expectedPrimeCount(llUpperLimit) == 0)
+        cout << "No fixed-limit sieve for " << llUpperLimit << ", using the word sieve" << endl;
+
+    return withFixedSieve<prime_sieve_words>(llUpperLimit, [&](auto *tag)
+    {
+        return runSieveMode<remove_pointer_t<decltype(tag)>>(bOneshot, bQuiet, cSeconds, cThreads, llUpperLimit, bPrintPrimes);
+    });
+}
+
+// runSieveCooperative
+//
+// Every pass is one sieve to llUpperLimit with all cThreads threads working on it together, so besides
+// passes per second we can report how long a single sieve takes from start to finish.  A segmentBytes of 0
+// uses the engine's default segment size.
+
+int runSieveCooperative(int cSeconds, int cThreads, uint64_t llUpperLimit, size_t segmentBytes, bool bQuiet, bool bPrintPrimes) {
+    auto cPasses      = 0;
+    double bestPass   = 0;
+
+    if (segmentBytes == 0)
+        segmentBytes = defaultSegmentBytes();
+
+    if (!bQuiet)
+    {
+        printf("Computing primes to %lu cooperatively on %d thread%s for %d second%s.\n",
+            llUpperLimit,
+            cThreads,
+            cThreads == 1 ? "" : "s",
+            cSeconds,
+            cSeconds == 1 ? "" : "s"
+        );
+    }
+
+    worker_pool pool(cThreads);
+    if (!bQuiet && pool.pinned())
+        cout << "Affinity " << pool.describePlacement() << endl;
+
+    memory_snapshot memoryStart;
+    auto tStart       = steady_clock::now();
+
+    // With --profile the workers report the phases of their segments, and this thread those of the pass
+    profile_session &profile = profile_session::get();
+    profile.start();
+
+    std::unique_ptr<prime_sieve_segmented> sieve;
+    while (duration_cast<seconds>(steady_clock::now() - tStart).count() < cSeconds)
+    {
+        auto tPass = steady_clock::now();
         {
-            i++;
-            ullLimitRequested = (i == args.end()) ? 0LL : max((long long)1, atoll(i->c_str()));
+            profile_phase phase(PHASE_INIT);
+            if (!run_options::get().bReuseSieves)
+                sieve.reset();
+            if (sieve)
+                sieve->reset();
+            else
+                sieve.reset(new prime_sieve_segmented(llUpperLimit, cThreads, segmentBytes));
         }
-        else if (*i == "-1" || *i == "--oneshot") 
+        sieve->runSieve(pool);
+        if (profile.active())
         {
-            bOneshot = true;
-            cThreadsRequested = 1;
+            profile_phase phase(PHASE_COUNT);
+            volatile size_t cFound = sieve->countPrimes();
+            (void) cFound;
         }
-        else if (*i == "-p" || *i == "--print") 
+        auto passDuration = duration_cast<microseconds>(steady_clock::now() - tPass).count()/1000000.0;
+        if (cPasses == 0 || passDuration < bestPass)
+            bestPass = passDuration;
+        cPasses++;
+    }
+    sieve.reset();
+    memory_snapshot memoryEnd;
+
+    auto tEnd = steady_clock::now() - tStart;
+    auto duration = duration_cast<microseconds>(tEnd).count()/1000000.0;
+    profile.finish("cooperative", llUpperLimit, cThreads, cPasses, duration);
+
+    prime_sieve_segmented checkSieve(llUpperLimit, cThreads, segmentBytes);
+    checkSieve.runSieve(pool);
+    auto result = checkSieve.validateResults() ? checkSieve.countPrimes() : 0;
+
+    if (!bQuiet) {
+        checkSieve.printResults(bPrintPrimes, duration, cPasses, cThreads, bestPass);
+        printPageReport();
+        cout << memoryEnd.describeSince(memoryStart, cPasses) << endl;
+    } else
+        cout << cThreads << ", " << cPasses / duration << ", " << duration / cPasses << ", " << bestPass << endl;
+
+    return result;
+}
+
+// runCooperativeMode
+//
+// Oneshot, timed or (with --quiet) a sweep over 1..cThreads threads for the cooperative engine.
+
+int runCooperativeMode(bool bOneshot, bool bQuiet, int cSeconds, int cThreads, uint64_t llUpperLimit, size_t segmentBytes, bool bPrintPrimes) {
+    int result = 0;
+    if(bOneshot) {
+        // With --profile the workers report the phases of their segments, as in runSieveCooperative
+        profile_session &profile = profile_session::get();
+        profile.start();
+
+        std::unique_ptr<prime_sieve_segmented> checkSieve;
         {
-             bPrintPrimes = true;
+            profile_phase phase(PHASE_INIT);
+            checkSieve.reset(new prime_sieve_segmented(llUpperLimit, cThreads, segmentBytes ? segmentBytes : defaultSegmentBytes()));
         }
-        else if (*i == "-q" || *i == "--quiet") 
-        {
-             bQuiet = true;
-        }        
-        else 
-        {
-            fprintf(stderr, "Unknown argument: %s\n", i->c_str());
-            return 0;
+        auto tStart = steady_clock::now();
+        checkSieve->runSieve();
+        auto duration = duration_cast<microseconds>(steady_clock::now() - tStart).count()/1000000.0;
+        profileOneshotCount(*checkSieve);
+        profile.finish("cooperative", llUpperLimit, cThreads, 1, duration);
+
+        result = checkSieve->validateResults() ? checkSieve->countPrimes() : 0;
+        checkSieve->printResults(bPrintPrimes, duration, 1, cThreads, duration);
+        printPageReport();
+    } else if(!bQuiet) {
+        result = runSieveCooperative(cSeconds, cThreads, llUpperLimit, segmentBytes, bQuiet, bPrintPrimes);
+    } else {
+        for(int i=1; i<=cThreads; i++) {
+            result = runSieveCooperative(cSeconds, i, llUpperLimit, segmentBytes, bQuiet, bPrintPrimes);
         }
     }
+    return result;
+}
 
-    if(cTrancheSize > 0 && cThreadsRequested > 1) {
-        cout << "only one of --tranches or --threads can be specified" << endl;
-        return 0;
-    }
+// measureIndependent
+//
+// The tuner's trial for the engines that run one whole sieve per thread.  With pCount set it also runs one
+// more sieve afterwards and reports how many primes it found.
 
-    if (!bQuiet)
+template <typename Sieve>
+double measureIndependent(const tuned_config &config, const cpu_affinity &affinity, double cSeconds, size_t *pCount) {
+    worker_pool pool(config.threads, affinity);
+    auto tStart = steady_clock::now();
+    uint64_t cPasses = runIndependentPasses<Sieve>(pool, config.limit, duration<double>(cSeconds));
+    double elapsed = duration<double>(steady_clock::now() - tStart).count();
+
+    if (pCount)
     {
-        cout << "Primes Benchmark (c) 2021 Dave's Garage - http://github.com/davepl/primes" << endl;
-        cout << "-------------------------------------------------------------------------" << endl;
+        Sieve checkSieve(config.limit);
+        checkSieve.runSieve();
+        *pCount = checkSieve.countPrimes();
     }
+    return cPasses / elapsed;
+}
 
-    if (bOneshot)
-        cout << "Oneshot is on" << endl;
+// measureFixed
+//
+// measureIndependent for the prime_sieve_fixed instantiation of config.limit, as runFixedMode picks it.
 
-    if (bOneshot && (cSecondsRequested > 0 || cThreadsRequested > 1))   
+double measureFixed(const tuned_config &config, const cpu_affinity &affinity, double cSeconds, size_t *pCount) {
+    return withFixedSieve<prime_sieve_words>(config.limit, [&](auto *tag)
     {
-        cout << "Oneshot option cannot be mixed with second count or thread count." << endl;
-        return 0;
-    }
+        return measureIndependent<remove_pointer_t<decltype(tag)>>(config, affinity, cSeconds, pCount);
+    });
+}
 
-    auto result = 0;
-    auto cSeconds     = (cSecondsRequested ? cSecondsRequested : 5);
-    auto cThreads     = (cThreadsRequested ? cThreadsRequested : thread::hardware_concurrency());
-    auto llUpperLimit = (ullLimitRequested ? ullLimitRequested : DEFAULT_UPPER_LIMIT);
-    if(!bQuiet) {
-        cout << "seconds " << cSeconds << ", threads " << cThreads << ", upper limit " << llUpperLimit << endl;
-    }
+// sieve_engine
+//
+// The registry of engines that run one whole sieve per thread, which --engine, -w, -F and -W pick from and
+// the tuner and --bench measure.  Each entry holds its runner and its tuner trial, instantiated for the
+// concrete sieve class, so a lookup costs one indirect call per run and the passes themselves never go
+// through anything virtual.  A new engine is a class with the prime_sieve_words interface, an engineName
+// overload and a line here.  bTune marks the ones --tune tries: wheel2 is the word sieve over again, and
+// Atkin's and Euler's sieves never came close to the others, so they are only there to be compared with
+// --bench --engine.
+
+struct sieve_engine
+{
+    const char *name;
+    int (*run)(bool bOneshot, bool bQuiet, int cSeconds, int cThreads, uint64_t llUpperLimit, bool bPrintPrimes);
+    double (*measure)(const tuned_config &config, const cpu_affinity &affinity, double cSeconds, size_t *pCount);
+    bool bTune;
+};
 
-    if(cTrancheSize > 0) {
-        if(bOneshot) {
-            prime_sieve_tranches checkSieve(llUpperLimit, cTrancheSize);
+template <typename Sieve>
+constexpr sieve_engine independentEngine(const char *name, bool bTune) {
+    return { name, &runSieveMode<Sieve>, &measureIndependent<Sieve>, bTune };
+}
+
+const sieve_engine SIEVE_ENGINES[] =
+{
+    independentEngine<prime_sieve>("basic", true),
+    independentEngine<prime_sieve_words>("words", true),
+    { "fixed", &runFixedMode, &measureFixed, false },          // Tuned only at the limits it is compiled for
+    independentEngine<prime_sieve_wheel<2>>("wheel2", false),
+    independentEngine<prime_sieve_wheel<6>>("wheel6", true),
+    independentEngine<prime_sieve_wheel<30>>("wheel30", true),
+    independentEngine<prime_sieve_wheel<210>>("wheel210", true),
+    independentEngine<prime_sieve_atkin>("atkin", false),
+    independentEngine<prime_sieve_linear>("linear", false),
+    independentEngine<prime_sieve_pritchard>("pritchard", true),
+};
+
+// The engines --engine knows besides the registry, which have runners and trials of their own.  "all" runs
+// them after the registry's, at their default segment and tranche sizes.
+const char *const MODE_ENGINES[] = { "cooperative", "tranches", "bucket" };
+
+const sieve_engine *findEngine(const string &name) {
+    for (auto &engine : SIEVE_ENGINES)
+        if (name == engine.name)
+            return &engine;
+    return nullptr;
+}
+
+bool isModeEngine(const string &name) {
+    for (auto mode : MODE_ENGINES)
+        if (name == mode)
+            return true;
+    return false;
+}
+
+// measureConfig
+//
+// Runs a candidate configuration for roughly cSeconds and returns its passes per second, or 0 if it names an
+// engine we don't have.  The bucket engine is only measured for --bench, never tuned; with pCount its last
+// pass's count is reported, as it has no bitmap for a separate check sieve to differ from.
+
+double measureConfig(const tuned_config &config, double cSeconds, size_t *pCount = nullptr) {
+    cpu_affinity affinity;
+    parseAffinity(config.affinity, affinity);
+
+    if (const sieve_engine *engine = findEngine(config.engine))
+        return engine->measure(config, affinity, cSeconds, pCount);
+
+    uint64_t cPasses = 0;
+    auto tStart = steady_clock::now();
+    auto tEnd   = tStart + duration_cast<steady_clock::duration>(duration<double>(cSeconds));
+
+    if (config.engine == "tranches")
+    {
+        uint64_t cTrancheSize = config.segment ? config.segment : prime_sieve_tranches::defaultTrancheSize();
+        do {
+            std::unique_ptr<prime_sieve_tranches>(new prime_sieve_tranches(config.limit, cTrancheSize))->runSieve();
+            cPasses++;
+        } while (steady_clock::now() < tEnd);
+        double elapsed = duration<double>(steady_clock::now() - tStart).count();
+
+        if (pCount)
+        {
+            prime_sieve_tranches checkSieve(config.limit, cTrancheSize);
             checkSieve.runSieve();
-            result = checkSieve.validateResults() ? checkSieve.countPrimes() : 0;
-            checkSieve.printResults(bPrintPrimes, 0, 1, 1);
-        } else {
-            result = runSieveTranche(cSeconds, cTrancheSize, llUpperLimit, bQuiet, bPrintPrimes);
+            *pCount = checkSieve.countPrimes();
         }
-    } else {
-        if(!bQuiet) {
-            if(bOneshot) {
-                prime_sieve checkSieve(llUpperLimit);
-                checkSieve.runSieve();
-                result = checkSieve.validateResults() ? checkSieve.countPrimes() : 0;
-                checkSieve.printResults(bPrintPrimes, 0, 1, 1);
-            } else {
-                result = runSieveThreads(cSeconds, cThreads, llUpperLimit, bQuiet, bPrintPrimes);
-            }     
-        } else {
-            for(int i=1; i<=cThreads; i++) {
-                result = runSieveThreads(cSeconds, i, llUpperLimit, bQuiet, bPrintPrimes);
-            }
+        return cPasses / elapsed;
+    }
+
+    if (config.engine == "cooperative")
+    {
+        size_t segmentBytes = config.segment ? config.segment : defaultSegmentBytes();
+        worker_pool pool(config.threads, affinity);
+        tStart = steady_clock::now();
+        tEnd   = tStart + duration_cast<steady_clock::duration>(duration<double>(cSeconds));
+        do {
+            std::unique_ptr<prime_sieve_segmented>(new prime_sieve_segmented(config.limit, config.threads, segmentBytes))->runSieve(pool);
+            cPasses++;
+        } while (steady_clock::now() < tEnd);
+        double elapsed = duration<double>(steady_clock::now() - tStart).count();
+
+        if (pCount)
+        {
+            prime_sieve_segmented checkSieve(config.limit, config.threads, segmentBytes);
+            checkSieve.runSieve(pool);
+            *pCount = checkSieve.countPrimes();
         }
+        return cPasses / elapsed;
+    }
+
+    if (config.engine == "bucket")
+    {
+        size_t segmentBytes = config.segment ? config.segment : prime_sieve_bucket::defaultSegmentBytes();
+        worker_pool pool(config.threads, affinity);
+        prime_sieve_bucket sieve(config.limit, config.threads, segmentBytes);
+        tStart = steady_clock::now();
+        tEnd   = tStart + duration_cast<steady_clock::duration>(duration<double>(cSeconds));
+        do {
+            sieve.reset();
+            sieve.runSieve(pool);
+            cPasses++;
+        } while (steady_clock::now() < tEnd);
+        double elapsed = duration<double>(steady_clock::now() - tStart).count();
+
+        if (pCount)
+            *pCount = sieve.countPrimes();
+        return cPasses / elapsed;
+    }
+
+    return 0;
+}
+
+// tuneCandidates
+//
+// Everything --tune considers for one limit: each independent engine and the cooperative one at 1, 2, 4, ...
+// threads up to cMaxThreads, the cooperative engine at segment sizes around the L2 cache, the tranche engine
+// at tranche sizes around the L1 and L2 caches, and with more than one thread, unpinned as well as compact
+// and scatter placement.
+
+vector<tuned_config> tuneCandidates(uint64_t llUpperLimit, unsigned int cMaxThreads) {
+    vector<unsigned int> threadCounts;
+    for (unsigned int t = 1; t < cMaxThreads; t *= 2)
+        threadCounts.push_back(t);
+    threadCounts.push_back(cMaxThreads);
+
+    const size_t l1 = cacheSizeBytes(1), l2 = cacheSizeBytes(2);
+    vector<string> independentEngines;
+    for (auto &engine : SIEVE_ENGINES)
+        if (engine.bTune)
+            independentEngines.push_back(engine.name);
+    if (expectedPrimeCount(llUpperLimit) != 0)
+        independentEngines.push_back("fixed");
+
+    vector<tuned_config> candidates;
+    auto add = [&](const string &engine, unsigned int threads, uint64_t segment)
+    {
+        for (auto policy : { affinity_policy::none, affinity_policy::compact, affinity_policy::scatter })
+        {
+            cpu_affinity affinity;
+            affinity.policy = policy;
+            if (threads == 1 && policy != affinity_policy::none)
+                continue;
+            tuned_config config;
+            config.limit    = llUpperLimit;
+            config.engine   = engine;
+            config.threads  = threads;
+            config.segment  = segment;
+            config.affinity = affinityName(affinity);
+            candidates.push_back(config);
+        }
+    };
+
+    for (auto threads : threadCounts)
+    {
+        for (auto engine : independentEngines)
+            add(engine, threads, 0);
+        for (size_t segmentBytes : { l1, l2 / 2, l2, l2 * 2 })
+            add("cooperative", threads, segmentBytes);
+    }
+    for (uint64_t trancheBits : { l1 * 4, l1 * 8, l2 * 4, l2 * 8 })
+        add("tranches", 1, trancheBits);
+
+    return candidates;
+}
+
+// runTune
+//
+// Successive halving: every candidate gets a short trial, the slower half is dropped, and the survivors get
+// trials twice as long, until one is left.  The winner's count is validated (against Meissel-Lehmer for
+// limits without historical data) before it is written to the tune file.
+
+int runTune(uint64_t llUpperLimit, unsigned int cMaxThreads, const string &tuneFile, bool bQuiet) {
+    vector<tuned_config> candidates = tuneCandidates(llUpperLimit, cMaxThreads);
+
+    if (!bQuiet)
+        printf("Tuning for limit %lu: %zu candidates on up to %u thread%s.\n",
+            llUpperLimit, candidates.size(), cMaxThreads, cMaxThreads == 1 ? "" : "s");
+
+    double cSeconds = 0.05;
+    for (int round = 1; candidates.size() > 1; round++, cSeconds *= 2)
+    {
+        for (auto &config : candidates)
+            config.passesPerSecond = measureConfig(config, cSeconds);
+
+        stable_sort(candidates.begin(), candidates.end(), [](const tuned_config &a, const tuned_config &b)
+        {
+            return a.passesPerSecond > b.passesPerSecond;
+        });
+
+        if (!bQuiet)
+            cout << "Round " << round << ": " << candidates.size() << " candidates at " << cSeconds << " s, best "
+                 << candidates[0].describe() << " (" << candidates[0].passesPerSecond << " passes/s)" << endl;
+
+        candidates.resize((candidates.size() + 1) / 2);
+    }
+
+    tuned_config &best = candidates[0];
+    size_t count = 0;
+    best.passesPerSecond = measureConfig(best, cSeconds, &count);
+
+    if (!validatePrimeCount(llUpperLimit, count))
+    {
+        cout << "Tuned configuration " << best.describe() << " found " << count << " primes instead of "
+             << cachedPrimeCount(llUpperLimit) << ", not saved" << endl;
+        return 0;
+    }
+
+    if (!saveTunedConfig(tuneFile, best))
+    {
+        fprintf(stderr, "Cannot write %s\n", tuneFile.c_str());
+        return 0;
+    }
+
+    cout << "Best: " << best.describe() << ", " << best.passesPerSecond << " passes/s, saved to " << tuneFile << endl;
+    return (int) count;
+}
+
+// runBenchmark
+//
+// Warmup trials, then cTrials timed trials of every configuration, summarized with outliers rejected and
+// written out as one record each.  The records can be saved as a baseline and compared against an earlier
+// one.  Returns the process exit code: 0 when all is well, 1 on a significant regression, 2 when a
+// configuration produced a wrong count or a file could not be read or written.
+
+int runBenchmark(const vector<tuned_config> &configs, const bench_options &options) {
+    ofstream file;
+    if (!options.outputPath.empty())
+    {
+        file.open(options.outputPath, ios::trunc);
+        if (!file)
+        {
+            fprintf(stderr, "Cannot write %s\n", options.outputPath.c_str());
+            return 2;
+        }
+    }
+    ostream &out = options.outputPath.empty() ? cout : file;
+    if (options.bCsv)
+        out << bench_record::csvHeader() << endl;
+
+    const string host = hostName(), cpu = cpuModelName();
+    vector<bench_record> records;
+    int exitCode = 0;
+
+    for (const auto &config : configs)
+    {
+        for (unsigned int i = 0; i < options.cWarmup; i++)
+            measureConfig(config, options.trialSeconds);
+
+        vector<double> samples;
+        size_t count = 0;
+        for (unsigned int i = 0; i < options.cTrials; i++)
+            samples.push_back(measureConfig(config, options.trialSeconds, i + 1 == options.cTrials ? &count : nullptr));
+
+        // Limits without historical data are checked against Meissel-Lehmer
+        size_t expected = expectedPrimeCount(config.limit);
+        if (expected == 0)
+            expected = cachedPrimeCount(config.limit);
+
+        bench_record record;
+        record.host     = host;
+        record.cpu      = cpu;
+        record.engine   = config.engine;
+        record.limit    = config.limit;
+        record.threads  = config.threads;
+        record.segment  = config.segment;
+        record.affinity = config.affinity;
+        record.warmup   = options.cWarmup;
+        record.stats    = trial_stats::summarize(samples);
+        record.bValid   = count == expected;
+        if (!record.bValid)
+            exitCode = 2;
+
+        out << (options.bCsv ? record.toCsv() : record.toJson()) << endl;
+        records.push_back(record);
+    }
+
+    if (!options.recordPath.empty() && !saveBaseline(options.recordPath, records))
+    {
+        fprintf(stderr, "Cannot write %s\n", options.recordPath.c_str());
+        return 2;
+    }
+
+    if (!options.comparePath.empty())
+    {
+        for (const auto &record : records)
+        {
+            const bench_record *baseline = nullptr;
+            for (const auto &candidate : benchmark_baseline::get().records)
+                if (candidate.sameConfig(record))
+                    baseline = &candidate;
+
+            tuned_config config;
+            config.engine   = record.engine;
+            config.threads  = record.threads;
+            config.segment  = record.segment;
+            config.affinity = record.affinity;
+            if (!baseline)
+            {
+                cerr << "No baseline for limit " << record.limit << " " << config.describe() << endl;
+                continue;
+            }
+
+            double change = 0;
+            bool bRegression = regressionTest(baseline->stats, record.stats, change);
+            cerr << (bRegression ? "REGRESSION: " : "OK: ") << "limit " << record.limit << " " << config.describe()
+                 << ", median " << record.stats.median << " vs " << baseline->stats.median << " passes/s ("
+                 << (change >= 0 ? "+" : "") << change * 100 << "%)" << endl;
+            if (bRegression && exitCode == 0)
+                exitCode = 1;
+        }
+    }
+
+    return exitCode;
+}
+
+// runSaveSieve
+//
+// Sieves once with the cooperative engine and writes the bitmap to a sieve file for --load to map later.
+
+int runSaveSieve(const string &path, uint64_t llUpperLimit, unsigned int cThreads, size_t cSegmentBytes, bool bQuiet) {
+    auto tStart = steady_clock::now();
+    prime_sieve_segmented sieve(llUpperLimit, cThreads, cSegmentBytes ? cSegmentBytes : defaultSegmentBytes());
+    sieve.runSieve();
+    auto sieveTime = duration_cast<microseconds>(steady_clock::now() - tStart).count()/1000000.0;
+
+    if (!sieve.validateResults()) {
+        cout << "Sieve for limit " << llUpperLimit << " failed validation, not saved" << endl;
+        return 0;
+    }
+
+    tStart = steady_clock::now();
+    if (!saveSieveFile(path, sieve.view()))
+        return 0;
+    auto saveTime = duration_cast<microseconds>(steady_clock::now() - tStart).count()/1000000.0;
+
+    if (!bQuiet)
+        cout << "Saved limit " << llUpperLimit << " to " << path << ": "
+             << SIEVE_FILE_DATA_OFFSET + sieve.view().cWords() * sizeof(uint64_t) << " bytes, "
+             << "Sieve: " << sieveTime << ", Write: " << saveTime << endl;
+    return (int) sieve.countPrimes();
+}
+
+// runLoadSieve
+//
+// Maps a sieve file instead of sieving and answers from the mapping.  Map is the time to open and check the
+// header; Count is the first pass over the words, which is where the pages are actually read in.
+
+int runLoadSieve(const string &path, bool bVerify, bool bQuiet, bool bPrintPrimes) {
+    auto tStart = steady_clock::now();
+    mapped_sieve file(path);
+    auto mapTime = duration_cast<microseconds>(steady_clock::now() - tStart).count()/1000000.0;
+    if (!file.ok()) {
+        fprintf(stderr, "Cannot load %s: %s\n", path.c_str(), file.lastError().c_str());
+        return 0;
+    }
+
+    // main could only check the --limit given, not the file's
+    if (bPrintPrimes && !prime_output::get().holds(file.info().limit)) {
+        cout << "--format u32 only holds primes below 2^32" << endl;
+        return 0;
+    }
+
+    if (bVerify && !file.verify()) {
+        fprintf(stderr, "Cannot load %s: checksum or count mismatch\n", path.c_str());
+        return 0;
+    }
+
+    bitmap_view bitmap = file.view();
+    tStart = steady_clock::now();
+    size_t count = bitmap.countPrimes();
+    auto countTime = duration_cast<microseconds>(steady_clock::now() - tStart).count()/1000000.0;
+
+    if (bPrintPrimes)
+        bitmap.printPrimes();
+
+    bool bValid = count == file.info().count && validatePrimeCount(bitmap.limit, count);
+    if (!bQuiet || !bValid)
+        cout << "Loaded " << path << ", "
+             << "Map: "     << mapTime << ", "
+             << "Count time: " << countTime << ", "
+             << "Limit: "   << bitmap.limit << ", "
+             << "Count: "   << count << ", "
+             << "Valid : "  << (bValid ? "Pass" : "FAIL!")
+             << "\n";
+    return bValid ? (int) count : 0;
+}
+
+// runRangeSieve
+//
+// Sieves the window [lo, hi) with range_sieve, repeatedly for cSeconds on cThreads threads as
+// runSieveCooperative does, or once with --oneshot.  The seed primes are found once, up front.
+
+int runRangeSieve(uint64_t lo, uint64_t hi, int cSeconds, bool bOneshot, int cThreads, size_t segmentBytes, bool bQuiet, bool bPrintPrimes) {
+    auto cPasses      = 0;
+    double bestPass   = 0;
+
+    if (segmentBytes == 0)
+        segmentBytes = defaultSegmentBytes();
+
+    if (!bQuiet)
+        printf("Computing primes in [%lu, %lu) on %d thread%s%s.\n", lo, hi, cThreads, cThreads == 1 ? "" : "s",
+            bOneshot ? "" : (" for " + to_string(cSeconds) + " second" + (cSeconds == 1 ? "" : "s")).c_str());
+
+    worker_pool pool(cThreads);
+    if (!bQuiet && pool.pinned())
+        cout << "Affinity " << pool.describePlacement() << endl;
+
+    range_sieve sieve(lo, hi, cThreads, segmentBytes);
+    auto tStart = steady_clock::now();
+    do
+    {
+        auto tPass = steady_clock::now();
+        sieve.reset();
+        sieve.runSieve(pool);
+        auto passDuration = duration_cast<microseconds>(steady_clock::now() - tPass).count()/1000000.0;
+        if (cPasses == 0 || passDuration < bestPass)
+            bestPass = passDuration;
+        cPasses++;
+    } while (!bOneshot && duration_cast<seconds>(steady_clock::now() - tStart).count() < cSeconds);
+    auto duration = duration_cast<microseconds>(steady_clock::now() - tStart).count()/1000000.0;
+
+    auto result = (hi > RANGE_VALIDATE_MAX || sieve.validateResults()) ? sieve.countPrimes() : 0;
+    if (!bQuiet) {
+        sieve.printResults(bPrintPrimes, duration, cPasses, cThreads, bestPass);
+        printPageReport();
+    } else
+        cout << cThreads << ", " << cPasses / duration << ", " << duration / cPasses << ", " << bestPass << endl;
+
+    return result;
+}
+
+// runBucketSieve
+//
+// Counts the primes below llUpperLimit with prime_sieve_bucket, repeatedly for cSeconds on cThreads threads
+// as runSieveCooperative does, or once with --oneshot.  There is no bitmap left to print.  With --profile the
+// workers report the phases of their segments.
+
+int runBucketSieve(uint64_t llUpperLimit, int cSeconds, bool bOneshot, int cThreads, size_t segmentBytes, bool bQuiet) {
+    auto cPasses      = 0;
+    double bestPass   = 0;
+
+    if (segmentBytes == 0)
+        segmentBytes = prime_sieve_bucket::defaultSegmentBytes();
+
+    if (!bQuiet)
+        printf("Counting primes to %lu with buckets on %d thread%s%s.\n", llUpperLimit, cThreads, cThreads == 1 ? "" : "s",
+            bOneshot ? "" : (" for " + to_string(cSeconds) + " second" + (cSeconds == 1 ? "" : "s")).c_str());
+
+    worker_pool pool(cThreads);
+    if (!bQuiet && pool.pinned())
+        cout << "Affinity " << pool.describePlacement() << endl;
+
+    profile_session &profile = profile_session::get();
+    profile.start();
+
+    prime_sieve_bucket sieve(llUpperLimit, cThreads, segmentBytes);
+    auto tStart = steady_clock::now();
+    do
+    {
+        auto tPass = steady_clock::now();
+        sieve.reset();
+        sieve.runSieve(pool);
+        auto passDuration = duration_cast<microseconds>(steady_clock::now() - tPass).count()/1000000.0;
+        if (cPasses == 0 || passDuration < bestPass)
+            bestPass = passDuration;
+        cPasses++;
+    } while (!bOneshot && duration_cast<seconds>(steady_clock::now() - tStart).count() < cSeconds);
+    auto duration = duration_cast<microseconds>(steady_clock::now() - tStart).count()/1000000.0;
+    profile.finish("bucket", llUpperLimit, cThreads, cPasses, duration);
+
+    auto result = sieve.validateResults() ? sieve.countPrimes() : 0;
+    if (!bQuiet)
+        sieve.printResults(duration, cPasses, cThreads, bestPass);
+    else
+        cout << cThreads << ", " << cPasses / duration << ", " << duration / cPasses << ", " << bestPass << endl;
+
+    return result;
+}
+
+// runBatch
+//
+// Reads job specs from a file, or stdin for "-", and counts every job with batch_sieve on cThreads threads.
+// The jobs are all submitted at once when the clock starts, after the seed primes are found, so a job's
+// latency includes the time it queued; Busy is the thread time its pieces took.  Jobs with nothing to sieve
+// are left out of the latency percentiles and counted as Empty.  Counts are checked against Meissel-Lehmer
+// afterwards, up to RANGE_VALIDATE_MAX.  Returns how many of the jobs validated.
+
+int runBatch(const string &path, unsigned int cThreads, size_t segmentBytes, bool bQuiet) {
+    vector<unique_ptr<batch_job>> jobs;
+    string error;
+    bool bParsed;
+    if (path == "-")
+        bParsed = parseBatchJobs(cin, jobs, error);
+    else
+    {
+        ifstream in(path);
+        if (!in)
+        {
+            fprintf(stderr, "Cannot read %s\n", path.c_str());
+            return 0;
+        }
+        bParsed = parseBatchJobs(in, jobs, error);
+    }
+    if (!bParsed)
+    {
+        fprintf(stderr, "Bad job spec at %s\n", error.c_str());
+        return 0;
+    }
+    if (jobs.empty())
+    {
+        fprintf(stderr, "No jobs in %s\n", path.c_str());
+        return 0;
+    }
+
+    batch_sieve sieve(segmentBytes ? segmentBytes : cacheSizeBytes(1));
+    worker_pool pool(cThreads);
+
+    uint64_t maxHi = 0, cNumbers = 0;
+    for (auto &job : jobs)
+    {
+        maxHi = max(maxHi, job->hi);
+        cNumbers += job->hi - job->lo;
+    }
+    auto tSeeds = steady_clock::now();
+    sieve.computeSeedPrimes(maxHi);
+    auto tStart = steady_clock::now();
+    sieve.run(jobs, pool, tStart);
+    double elapsed = duration<double>(steady_clock::now() - tStart).count();
+
+    vector<double> latencies;
+    int cValid = 0;
+    size_t cChecked = 0;
+    for (size_t j = 0; j < jobs.size(); j++)
+    {
+        batch_job &job = *jobs[j];
+        double latency = duration<double>(job.tDone - tStart).count();
+        if (job.hasWork())
+            latencies.push_back(latency);
+
+        bool bChecked = job.hi <= RANGE_VALIDATE_MAX;
+        bool bValid = bChecked && job.count == cachedPrimeCount(job.hi) - cachedPrimeCount(job.lo);
+        cChecked += bChecked;
+        cValid += bValid;
+
+        if (!bQuiet)
+            cout << "Job "     << j + 1 << ": " << job.spec << ", "
+                 << "Count: "   << job.count << ", "
+                 << "Latency: " << latency << ", "
+                 << "Busy: "    << job.busyNanos / 1e9 << ", "
+                 << "Pieces: "  << job.cTasks << ", "
+                 << "Stolen: "  << job.cStolen << ", "
+                 << "Valid : "  << (!bChecked ? "unchecked" : bValid ? "Pass" : "FAIL!")
+                 << endl;
+    }
+
+    sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double fraction)
+    {
+        return latencies.empty() ? 0.0 : latencies[min(latencies.size() - 1, (size_t) (fraction * latencies.size()))];
+    };
+    double maxLatency = percentile(1.0);
+
+    if (!bQuiet)
+        cout << "Jobs: "        << jobs.size() << ", "
+             << "Threads: "     << pool.size() << ", "
+             << "Segment: "     << sieve.segmentBytes() << ", "
+             << "Seed primes: " << duration<double>(tStart - tSeeds).count() << ", "
+             << "Time: "        << elapsed << ", "
+             << "Jobs per second: " << jobs.size() / elapsed << ", "
+             << "Numbers per second: " << cNumbers / elapsed << ", "
+             << "Latency p50: " << percentile(0.5) << ", "
+             << "p99: "         << percentile(0.99) << ", "
+             << "max: "         << maxLatency << ", "
+             << "Empty: "       << jobs.size() - latencies.size() << ", "
+             << "Steals: "      << sieve.cSteals << ", "
+             << "Valid : "      << cValid << " of " << cChecked
+             << endl;
+    else
+        cout << pool.size() << ", " << jobs.size() / elapsed << ", " << cNumbers / elapsed << ", " << percentile(0.5)
+             << ", " << maxLatency << endl;
+
+    return cValid;
+}
+
+// runWorker
+//
+// Serves a coordinator at 'address' with range_sieve on cThreads threads until it says BYE.  Returns how
+// many segments it sieved.
+
+int runWorker(const string &address, unsigned int cThreads, size_t segmentBytes, bool bQuiet) {
+#if defined(__linux__)
+    socket_address where;
+    if (!where.parse(address))
+    {
+        fprintf(stderr, "Bad address: %s\n", address.c_str());
+        return 0;
+    }
+
+    sieve_worker worker(cThreads, segmentBytes ? segmentBytes : defaultSegmentBytes());
+    string error;
+    if (!worker.connect(where, 10.0, error))
+    {
+        fprintf(stderr, "Cannot connect to %s: %s\n", address.c_str(), error.c_str());
+        return 0;
+    }
+    bool bOk = worker.run(error);
+    if (!bOk)
+        fprintf(stderr, "Worker stopped: %s\n", error.c_str());
+    if (!bQuiet)
+        cout << "Worker: " << worker.cSegments << " segments, busy " << worker.busySeconds << " s" << endl;
+    return (int) worker.cSegments;
+#else
+    fprintf(stderr, "--worker is not supported on this platform\n");
+    return 0;
+#endif
+}
+
+// runCoordinator
+//
+// Listens on 'address' and farms [lo, hi) out to workers in segments of 'chunk' numbers, counting, or with
+// bPrintPrimes collecting the primes and writing them out in order.  With cSpawn it starts that many local
+// workers of cWorkerThreads threads itself, by running this executable with --worker, and gives up if they
+// all exit before the work is done; without, it waits for workers for as long as it takes.
+
+int runCoordinator(const string &address, uint64_t lo, uint64_t hi, uint64_t chunk, unsigned int cSpawn,
+                   unsigned int cWorkerThreads, size_t segmentBytes, double workerTimeout, bool bQuiet, bool bPrintPrimes) {
+#if defined(__linux__)
+    socket_address where;
+    string error;
+    if (!where.parse(address))
+    {
+        fprintf(stderr, "Bad address: %s\n", address.c_str());
+        return 0;
+    }
+    int listenFd = openSocket(where, true, error);
+    if (listenFd < 0)
+    {
+        fprintf(stderr, "Cannot listen on %s: %s\n", address.c_str(), error.c_str());
+        return 0;
+    }
+
+    vector<pid_t> children;
+    for (unsigned int i = 0; i < cSpawn; i++)
+    {
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            close(listenFd);
+            vector<string> args = { "primes_par", "--worker", address, "-t", to_string(cWorkerThreads), "-q" };
+            if (segmentBytes)
+                args.insert(args.end(), { "--segment", to_string(segmentBytes) });
+            vector<char *> argv;
+            for (auto &arg : args)
+                argv.push_back(&arg[0]);
+            argv.push_back(nullptr);
+            execv("/proc/self/exe", argv.data());
+            _exit(127);
+        }
+        if (pid > 0)
+            children.push_back(pid);
+    }
+
+    sieve_coordinator coordinator(lo, hi, chunk, bPrintPrimes);
+    if (!bQuiet)
+        cerr << "Coordinating " << coordinator.segmentCount() << " segments of [" << lo << ", " << hi << ") on "
+             << address << (cSpawn ? ", " + to_string(children.size()) + " local workers" : "") << endl;
+
+    size_t cExited = 0;
+    auto bGiveUp = [&]()
+    {
+        while (cExited < children.size() && waitpid(-1, nullptr, WNOHANG) > 0)
+            cExited++;
+        return cSpawn > 0 && cExited == children.size();
+    };
+
+    auto tStart = steady_clock::now();
+    bool bDone = coordinator.run(listenFd, workerTimeout, bGiveUp, error);
+    double elapsed = duration<double>(steady_clock::now() - tStart).count();
+    close(listenFd);
+    if (where.bUnix)
+        unlink(where.path.c_str());
+
+    if (!bDone)
+    {
+        fprintf(stderr, "%s, %s not finished\n", error.c_str(), bPrintPrimes ? "primes" : "count");
+        for (auto pid : children)
+            kill(pid, SIGTERM);
+    }
+    for (; cExited < children.size(); cExited++)
+        waitpid(-1, nullptr, 0);
+    if (!bDone)
+        return 0;
+
+    bool bChecked = hi <= RANGE_VALIDATE_MAX;
+    bool bValid = bChecked && coordinator.count == cachedPrimeCount(hi) - cachedPrimeCount(lo);
+    size_t cLost = 0;
+    for (auto &worker : coordinator.connections())
+    {
+        cLost += worker->bLost;
+        if (!bQuiet)
+            cerr << worker->name << ": " << worker->cThreads << " threads, " << worker->cSegments << " segments, busy "
+                 << worker->busySeconds << " s" << (worker->bLost ? ", lost" : "") << endl;
+    }
+
+    if (!bQuiet)
+        cout << "Range: ["  << lo << ", " << hi << "), "
+             << "Segments: " << coordinator.segmentCount() << ", "
+             << "Workers: " << coordinator.connections().size() << ", "
+             << "Lost: "    << cLost << ", "
+             << "Reassigned: " << coordinator.cReassigned << ", "
+             << "Time: "    << elapsed << ", "
+             << "Numbers per second: " << (hi - lo) / elapsed << ", "
+             << "Count: "   << coordinator.count << ", "
+             << "Valid : "  << (!bChecked ? "unchecked" : bValid ? "Pass" : "FAIL!")
+             << endl;
+    else
+        cout << coordinator.connections().size() << ", " << (hi - lo) / elapsed << ", " << elapsed << endl;
+
+    return bValid || !bChecked ? (int) coordinator.count : 0;
+#else
+    fprintf(stderr, "--coordinator is not supported on this platform\n");
+    return 0;
+#endif
+}
+
+// runExtend
+//
+// Sieves to llUpperLimit, then raises the limit through each of extendLimits in turn with
+// prime_sieve_extendable::extend, timing every extension against building a sieve of the new limit from
+// scratch, both the extendable sieve and the plain word sieve.  A limit below the current one is a no-op, as
+// the sieve never shrinks.
+
+int runExtend(uint64_t llUpperLimit, const vector<uint64_t> &extendLimits, bool bQuiet) {
+    auto seconds = [](steady_clock::time_point tStart) {
+        return duration_cast<microseconds>(steady_clock::now() - tStart).count()/1000000.0;
+    };
+
+    auto tStart = steady_clock::now();
+    prime_sieve_extendable sieve(llUpperLimit);
+    sieve.runSieve();
+    auto buildTime = seconds(tStart);
+    if (!bQuiet)
+        cout << "Limit: " << llUpperLimit << ", Build: " << buildTime << ", Count: " << sieve.countPrimes()
+             << ", Valid : " << (sieve.validateResults() ? "Pass" : "FAIL!") << endl;
+
+    auto bValid = sieve.validateResults();
+    for (auto newLimit : extendLimits)
+    {
+        newLimit = llUpperLimit = max(llUpperLimit, newLimit);
+        tStart = steady_clock::now();
+        sieve.extend(newLimit);
+        auto extendTime = seconds(tStart);
+
+        tStart = steady_clock::now();
+        prime_sieve_extendable rebuilt(newLimit);
+        rebuilt.runSieve();
+        auto rebuildTime = seconds(tStart);
+
+        tStart = steady_clock::now();
+        prime_sieve_words words(newLimit);
+        words.runSieve();
+        auto wordsTime = seconds(tStart);
+
+        bool bStepValid = sieve.validateResults() && sieve.countPrimes() == words.countPrimes();
+        bValid = bValid && bStepValid;
+        if (!bQuiet || !bStepValid)
+            cout << "Extend to: " << newLimit << ", "
+                 << "Time: "      << extendTime << ", "
+                 << "Rebuild: "   << rebuildTime << ", "
+                 << "Words rebuild: " << wordsTime << ", "
+                 << "Sieving primes: " << sieve.sievingPrimeCount() << ", "
+                 << "Count: "     << sieve.countPrimes() << ", "
+                 << "Valid : "    << (bStepValid ? "Pass" : "FAIL!")
+                 << "\n";
+    }
+    return bValid ? (int) sieve.countPrimes() : 0;
+}
+
+// runCountOnly
+//
+// Counts the primes below the limit with prime_count.h instead of sieving, in far less time and memory than
+// a sieve at large limits.  Only limits in the historical data can be marked valid here, since for any
+// other limit Meissel-Lehmer is itself the validator; comparing the two methods is the check there.
+
+int runCountOnly(uint64_t llUpperLimit, const string &method, bool bQuiet) {
+    // Refuse limits whose tables can't fit rather than dying in the allocator (or the OOM killer)
+    uint64_t cbNeeded = method == "lucy" ? lucyMemoryBytes(llUpperLimit) : meissel_lehmer::memoryBytes(llUpperLimit);
+    uint64_t cbPhysical = UINT64_MAX;
+#if defined(__linux__)
+    cbPhysical = (uint64_t) sysconf(_SC_PHYS_PAGES) * (uint64_t) sysconf(_SC_PAGESIZE);
+#endif
+    if (cbNeeded > cbPhysical) {
+        cout << "--count-only needs " << cbNeeded << " bytes for limit " << llUpperLimit << ", more than the "
+             << cbPhysical << " bytes of memory here" << endl;
+        return 0;
+    }
+
+    auto tStart = steady_clock::now();
+    uint64_t count;
+    try {
+        count = method == "lucy" ? lucyPrimeCount(llUpperLimit) : primeCount(llUpperLimit);
+    }
+    catch (const std::bad_alloc &) {
+        cout << "--count-only could not allocate " << cbNeeded << " bytes for limit " << llUpperLimit << endl;
+        return 0;
+    }
+    auto duration = duration_cast<microseconds>(steady_clock::now() - tStart).count()/1000000.0;
+
+    size_t expected = expectedPrimeCount(llUpperLimit);
+    if (!bQuiet || (expected && expected != count))
+        cout << "Method: "  << (method == "lucy" ? "lucy" : "meissel-lehmer") << ", "
+             << "Time: "    << duration << ", "
+             << "Limit: "   << llUpperLimit << ", "
+             << "Count: "   << count << ", "
+             << "Valid : "  << (expected == 0 ? "unknown" : expected == count ? "Pass" : "FAIL!")
+             << "\n";
+    return (expected == 0 || expected == count) ? (int) count : 0;
+}
+
+// runQueryFile
+//
+// Reads whitespace-separated numbers from a file and times asking whether each is prime, against a sieve
+// mapped with --load or one built here up to the limit.  Runs the batched queryPrimes and the one-at-a-time
+// isPrime over the same numbers for cSeconds each and checks that they agree.  Returns how many are prime.
+
+int runQueryFile(const string &path, const string &loadPath, uint64_t llUpperLimit, unsigned int cThreads,
+                 int cSeconds, bool bQuiet) {
+    ifstream in(path);
+    if (!in) {
+        fprintf(stderr, "Cannot read %s\n", path.c_str());
+        return 0;
+    }
+    vector<uint64_t> values;
+    for (uint64_t n; in >> n; )
+        values.push_back(n);
+    if (values.empty()) {
+        fprintf(stderr, "No numbers in %s\n", path.c_str());
+        return 0;
+    }
+
+    unique_ptr<mapped_sieve> file;
+    unique_ptr<prime_sieve_segmented> sieve;
+    bitmap_view bitmap;
+    if (!loadPath.empty()) {
+        file.reset(new mapped_sieve(loadPath));
+        if (!file->ok()) {
+            fprintf(stderr, "Cannot load %s: %s\n", loadPath.c_str(), file->lastError().c_str());
+            return 0;
+        }
+        bitmap = file->view();
+    } else {
+        sieve.reset(new prime_sieve_segmented(llUpperLimit, cThreads, defaultSegmentBytes()));
+        sieve->runSieve();
+        bitmap = sieve->view();
+    }
+
+    size_t cBeyond = count_if(values.begin(), values.end(), [&](uint64_t n) { return n >= bitmap.limit; });
+    vector<uint8_t> batched(values.size()), single(values.size());
+
+    auto timeQueries = [&](auto &&query) {
+        size_t cRounds = 0;
+        auto tStart = steady_clock::now();
+        double elapsed = 0;
+        do {
+            query();
+            cRounds++;
+            elapsed = duration_cast<microseconds>(steady_clock::now() - tStart).count()/1000000.0;
+        } while (elapsed < cSeconds);
+        return cRounds * values.size() / elapsed;
+    };
+
+    size_t count = 0;
+    double batchedRate = timeQueries([&] { count = queryPrimes(bitmap, values.data(), values.size(), batched.data()); });
+    double singleRate  = timeQueries([&] {
+        for (size_t i = 0; i < values.size(); i++)
+            single[i] = isPrime(bitmap, values[i]);
+    });
+
+    bool bValid = batched == single;
+    if (!bQuiet || !bValid)
+        cout << "Queries: " << values.size() << ", "
+             << "Beyond limit: " << cBeyond << ", "
+             << "Limit: "   << bitmap.limit << ", "
+             << "Batched per second: " << batchedRate << ", "
+             << "Single per second: "  << singleRate << ", "
+             << "Primes: "  << count << ", "
+             << "Valid : "  << (bValid ? "Pass" : "FAIL!")
+             << "\n";
+    return bValid ? (int) count : 0;
+}
+
+int main(int argc, char **argv)
+{
+    vector<string> args(argv + 1, argv + argc);         // From first to last argument in the argv array
+    uint64_t ullLimitRequested = 0;
+    auto cThreadsRequested = 0;
+    auto cSecondsRequested = 0;
+    uint64_t cTrancheSize  = 0;
+    auto bPrintPrimes      = false;
+    auto bOneshot          = false;
+    auto bQuiet            = false;
+    auto bCooperative      = false;
+    auto bTune             = false;
+    auto bUseTuneFile      = true;
+    auto bAffinitySet      = false;
+    size_t cSegmentBytes   = 0;
+    string tuneFile        = DEFAULT_TUNE_FILE;
+    auto bBench            = false;
+    bench_options benchOptions;
+    string savePath, loadPath, queryPath, batchPath;
+    string coordinatorAddress, workerAddress;
+    unsigned int cSpawn    = 0;
+    uint64_t cChunk        = 1ULL << 30;
+    double workerTimeout   = 0;
+    auto bVerify           = false;
+    auto bCountOnly        = false;
+    auto bRange            = false;
+    auto bBucket           = false;
+    vector<uint64_t> extendLimits;
+    uint64_t ullFrom       = 0;
+    uint64_t ullTo         = 0;
+    string countMethod     = "meissel";
+    vector<string> engines;                             // From the registry or MODE_ENGINES, run one after another
+
+    // Process command-line args
+
+    for (auto i = args.begin(); i != args.end(); ++i) 
+    {
+        if (*i == "-h" || *i == "--help") {
+              cout << "Syntax: " << argv[0] << " [-t,--threads threads] [-s,--seconds seconds] [-l,--limit limit] [-r,--tranches bits|l1|l2|auto] [-c,--cooperative] [-B,--bucket] [-w,--words] [-F,--fixed] [-W,--wheel 2|6|30|210|all] [-e,--engine name,...|all|list] [-P,--presieve 0|13|17|19] [-1,--oneshot] [-p,--print] [-o,--output file] [-f,--format text|u32|u64] [-q,--quiet] [--segment bytes] [--pages auto|heap|thp|huge] [--reuse] [--live seconds] [--profile] [--profile-output file] [--no-arena] [--affinity none|compact|scatter|physical|cpu-list] [--tune] [--tune-file file] [--no-tune] [--bench] [--warmup n] [--trials n] [--bench-format json|csv] [--bench-output file] [--record-baseline file] [--compare-baseline file] [--save file] [--load file] [--verify] [--query-file file] [--batch file|-] [--coordinator address] [--worker address] [--spawn n] [--chunk numbers] [--worker-timeout seconds] [--count-only] [--count-method meissel|lucy] [--from lo] [--to hi] [--extend limit,...] [-h] " << endl;
+              cout << "--bench exits with 1 on a significant regression against --compare-baseline, 2 on a wrong count or I/O error" << endl;
+              cout << "Popcount kernel: " << popcountKernelName() << endl;
+              cout << "Topology: " << cpu_topology::get().summary() << endl;
+            return 0;
+        }
+        else if (*i == "-t" || *i == "--threads") 
+        {
+            i++;
+            cThreadsRequested = (i == args.end()) ? 0 : max(1, atoi(i->c_str()));
+        }
+        else if (*i == "-r" || *i == "--tranches") 
+        {
+            i++;
+            if (i == args.end())
+                break;
+            // size in bits, or the size of the L1/L2 data cache
+            if (*i == "auto")
+                cTrancheSize = prime_sieve_tranches::defaultTrancheSize();
+            else if (*i == "l1")
+                cTrancheSize = cacheSizeBytes(1) * 8;
+            else if (*i == "l2")
+                cTrancheSize = cacheSizeBytes(2) * 8;
+            else
+                cTrancheSize = max(1LL, atoll(i->c_str()));
+        }
+        else if (*i == "-c" || *i == "--cooperative")
+        {
+            bCooperative = true;
+        }
+        else if (*i == "-B" || *i == "--bucket")
+        {
+            bBucket = true;
+        }
+        else if (*i == "-w" || *i == "--words")
+        {
+            engines.push_back("words");
+        }
+        else if (*i == "-F" || *i == "--fixed")
+        {
+            engines.push_back("fixed");
+        }
+        else if (*i == "-W" || *i == "--wheel")
+        {
+            i++;
+            if (i == args.end())
+                break;
+            if (*i == "all")
+            {
+                for (auto &engine : SIEVE_ENGINES)
+                    if (strncmp(engine.name, "wheel", 5) == 0)
+                        engines.push_back(engine.name);
+            }
+            else if (findEngine("wheel" + *i))
+                engines.push_back("wheel" + *i);
+            else
+            {
+                fprintf(stderr, "Unsupported wheel: %s\n", i->c_str());
+                return 0;
+            }
+        }
+        else if (*i == "-e" || *i == "--engine")
+        {
+            i++;
+            if (i == args.end())
+                break;
+            if (*i == "list")
+            {
+                for (auto &engine : SIEVE_ENGINES)
+                    cout << engine.name << endl;
+                for (auto name : MODE_ENGINES)
+                    cout << name << endl;
+                return 0;
+            }
+            istringstream in(*i);
+            string name;
+            while (getline(in, name, ','))
+            {
+                if (name == "all")
+                {
+                    for (auto &engine : SIEVE_ENGINES)
+                        engines.push_back(engine.name);
+                    for (auto mode : MODE_ENGINES)
+                        engines.push_back(mode);
+                }
+                else if (findEngine(name) || isModeEngine(name))
+                    engines.push_back(name);
+                else
+                {
+                    fprintf(stderr, "Unknown engine: %s (--engine list shows them)\n", name.c_str());
+                    return 0;
+                }
+            }
+        }
+        else if (*i == "-P" || *i == "--presieve")
+        {
+            i++;
+            presieve_pattern::get().setLargestPrime((i == args.end()) ? 13 : atoi(i->c_str()));
+            if (i == args.end())
+                break;
+        }
+        else if (*i == "-s" || *i == "--seconds") 
+        {
+            i++;
+            cSecondsRequested = (i == args.end()) ? 0 : max(1, atoi(i->c_str()));
+        }
+        else if (*i == "-l" || *i == "--limit") 
+        {
+            i++;
+            ullLimitRequested = (i == args.end()) ? 0LL : max((long long)1, atoll(i->c_str()));
+        }
+        else if (*i == "-1" || *i == "--oneshot") 
+        {
+            bOneshot = true;
+        }
+        else if (*i == "-p" || *i == "--print") 
+        {
+             bPrintPrimes = true;
+        }
+        else if (*i == "-o" || *i == "--output")
+        {
+            i++;
+            if (i == args.end())
+                break;
+            prime_output::get().path = *i;
+            bPrintPrimes = true;
+        }
+        else if (*i == "-f" || *i == "--format")
+        {
+            i++;
+            if (i == args.end())
+                break;
+            if (!prime_output::parseFormat(*i, prime_output::get().format))
+            {
+                fprintf(stderr, "Unknown format: %s\n", i->c_str());
+                return 0;
+            }
+        }
+        else if (*i == "-q" || *i == "--quiet") 
+        {
+             bQuiet = true;
+        }        
+        else if (*i == "--segment")
+        {
+            i++;
+            cSegmentBytes = (i == args.end()) ? 0 : max(8LL, atoll(i->c_str()));
+            if (i == args.end())
+                break;
+        }
+        else if (*i == "--profile")
+        {
+            profile_session::get().bEnabled = true;
+        }
+        else if (*i == "--profile-output")
+        {
+            i++;
+            if (i != args.end())
+            {
+                profile_session::get().bEnabled = true;
+                profile_session::get().outputPath = *i;
+            }
+        }
+        else if (*i == "--live")
+        {
+            i++;
+            run_options::get().liveInterval = (i == args.end()) ? 0 : max(0.0, atof(i->c_str()));
+        }
+        else if (*i == "--reuse")
+        {
+            run_options::get().bReuseSieves = true;
+        }
+        else if (*i == "--no-arena")
+        {
+            buffer_arena::enabled() = false;
+        }
+        else if (*i == "--pages")
+        {
+            i++;
+            if (i == args.end())
+                break;
+            if (!page_options::parsePolicy(*i, page_options::get().policy))
+            {
+                fprintf(stderr, "Unknown page policy: %s\n", i->c_str());
+                return 0;
+            }
+        }
+        else if (*i == "--affinity")
+        {
+            i++;
+            if (i == args.end())
+                break;
+            if (!parseAffinity(*i, defaultAffinity()))
+            {
+                fprintf(stderr, "Bad affinity: %s (not a policy, or not a list of online CPUs)\n", i->c_str());
+                return 0;
+            }
+            bAffinitySet = true;
+        }
+        else if (*i == "--tune")
+        {
+            bTune = true;
+        }
+        else if (*i == "--tune-file")
+        {
+            i++;
+            if (i == args.end())
+                break;
+            tuneFile = *i;
+        }
+        else if (*i == "--no-tune")
+        {
+            bUseTuneFile = false;
+        }
+        else if (*i == "--save")
+        {
+            i++;
+            if (i == args.end())
+                break;
+            savePath = *i;
+        }
+        else if (*i == "--load")
+        {
+            i++;
+            if (i == args.end())
+                break;
+            loadPath = *i;
+        }
+        else if (*i == "--from" || *i == "--to")
+        {
+            auto bFrom = *i == "--from";
+            i++;
+            if (i == args.end())
+                break;
+            (bFrom ? ullFrom : ullTo) = strtoull(i->c_str(), nullptr, 10);
+            bRange = true;
+        }
+        else if (*i == "--extend")
+        {
+            i++;
+            if (i == args.end())
+                break;
+            istringstream in(*i);
+            string item;
+            while (getline(in, item, ','))
+                extendLimits.push_back(strtoull(item.c_str(), nullptr, 10));
+        }
+        else if (*i == "--count-only")
+        {
+            bCountOnly = true;
+        }
+        else if (*i == "--count-method")
+        {
+            i++;
+            if (i == args.end())
+                break;
+            if (*i != "meissel" && *i != "lucy")
+            {
+                fprintf(stderr, "Unknown counting method: %s\n", i->c_str());
+                return 0;
+            }
+            countMethod = *i;
+        }
+        else if (*i == "--query-file")
+        {
+            i++;
+            if (i == args.end())
+                break;
+            queryPath = *i;
+        }
+        else if (*i == "--batch")
+        {
+            i++;
+            if (i == args.end())
+                break;
+            batchPath = *i;
+        }
+        else if (*i == "--coordinator" || *i == "--worker")
+        {
+            auto bCoordinator = *i == "--coordinator";
+            i++;
+            if (i == args.end())
+                break;
+            (bCoordinator ? coordinatorAddress : workerAddress) = *i;
+        }
+        else if (*i == "--spawn")
+        {
+            i++;
+            cSpawn = (i == args.end()) ? 0 : max(0, atoi(i->c_str()));
+            if (i == args.end())
+                break;
+        }
+        else if (*i == "--chunk")
+        {
+            i++;
+            if (i == args.end())
+                break;
+            if (!parseJobNumber(*i, cChunk) || cChunk == 0)
+            {
+                fprintf(stderr, "Bad chunk size: %s\n", i->c_str());
+                return 0;
+            }
+        }
+        else if (*i == "--worker-timeout")
+        {
+            i++;
+            workerTimeout = (i == args.end()) ? 0 : max(0.0, atof(i->c_str()));
+            if (i == args.end())
+                break;
+        }
+        else if (*i == "--verify")
+        {
+            bVerify = true;
+        }
+        else if (*i == "--bench")
+        {
+            bBench = true;
+        }
+        else if (*i == "--warmup")
+        {
+            i++;
+            if (i == args.end())
+                break;
+            benchOptions.cWarmup = max(0, atoi(i->c_str()));
+        }
+        else if (*i == "--trials")
+        {
+            i++;
+            if (i == args.end())
+                break;
+            benchOptions.cTrials = max(1, atoi(i->c_str()));
+        }
+        else if (*i == "--bench-format")
+        {
+            i++;
+            if (i == args.end())
+                break;
+            if (*i != "json" && *i != "csv")
+            {
+                fprintf(stderr, "Unknown benchmark format: %s\n", i->c_str());
+                return 0;
+            }
+            benchOptions.bCsv = *i == "csv";
+        }
+        else if (*i == "--bench-output")
+        {
+            i++;
+            if (i == args.end())
+                break;
+            benchOptions.outputPath = *i;
+        }
+        else if (*i == "--record-baseline")
+        {
+            i++;
+            if (i == args.end())
+                break;
+            benchOptions.recordPath = *i;
+        }
+        else if (*i == "--compare-baseline")
+        {
+            i++;
+            if (i == args.end())
+                break;
+            benchOptions.comparePath = *i;
+            benchmark_baseline::get().records = loadBaseline(*i);
+            if (benchmark_baseline::get().records.empty())
+            {
+                fprintf(stderr, "No baseline records in %s\n", i->c_str());
+                return 2;
+            }
+        }
+        else 
+        {
+            fprintf(stderr, "Unknown argument: %s\n", i->c_str());
+            return 0;
+        }
+    }
+
+    // A mode engine named on its own is the same as its option, with that option's checks
+    if(engines.size() == 1 && isModeEngine(engines[0])) {
+        if (engines[0] == "cooperative")
+            bCooperative = true;
+        else if (engines[0] == "tranches")
+            cTrancheSize = cTrancheSize ? cTrancheSize : prime_sieve_tranches::defaultTrancheSize();
+        else
+            bBucket = true;
+        engines.clear();
+    }
+
+    if(bTune) {
+        auto llUpperLimit = (ullLimitRequested ? ullLimitRequested : DEFAULT_UPPER_LIMIT);
+        auto cMaxThreads  = (cThreadsRequested ? cThreadsRequested : max(1u, thread::hardware_concurrency()));
+        return runTune(llUpperLimit, cMaxThreads, tuneFile, bQuiet);
+    }
+
+    if(!extendLimits.empty())
+        return runExtend(ullLimitRequested ? ullLimitRequested : DEFAULT_UPPER_LIMIT, extendLimits, bQuiet);
+
+    if(bCountOnly)
+        return runCountOnly(ullLimitRequested ? ullLimitRequested : DEFAULT_UPPER_LIMIT, countMethod, bQuiet);
+
+    if(!savePath.empty() && !loadPath.empty()) {
+        cout << "only one of --save or --load can be specified" << endl;
+        return 0;
+    }
+
+    if(!savePath.empty()) {
+        auto llUpperLimit = (ullLimitRequested ? ullLimitRequested : DEFAULT_UPPER_LIMIT);
+        auto cThreads     = (cThreadsRequested ? cThreadsRequested : max(1u, thread::hardware_concurrency()));
+        return runSaveSieve(savePath, llUpperLimit, cThreads, cSegmentBytes, bQuiet);
+    }
+
+    if(!queryPath.empty()) {
+        auto llUpperLimit = (ullLimitRequested ? ullLimitRequested : DEFAULT_UPPER_LIMIT);
+        auto cThreads     = (cThreadsRequested ? cThreadsRequested : max(1u, thread::hardware_concurrency()));
+        return runQueryFile(queryPath, loadPath, llUpperLimit, cThreads, cSecondsRequested ? cSecondsRequested : 1, bQuiet);
+    }
+
+    if(bRange && !ullTo)
+        ullTo = ullFrom + DEFAULT_UPPER_LIMIT;
+
+    // Checked against the top of the window in range mode, before anything is written
+    if(bPrintPrimes && !prime_output::get().holds(bRange ? ullTo : ullLimitRequested)) {
+        cout << "--format u32 only holds primes below 2^32" << endl;
+        return 0;
+    }
+
+    if(!workerAddress.empty())
+        return runWorker(workerAddress, cThreadsRequested ? cThreadsRequested : max(1u, thread::hardware_concurrency()),
+            cSegmentBytes, bQuiet);
+
+    if(!coordinatorAddress.empty()) {
+        if(bRange && ullLimitRequested) {
+            cout << "--from/--to cannot be combined with --limit" << endl;
+            return 0;
+        }
+        uint64_t lo = bRange ? ullFrom : 0;
+        uint64_t hi = bRange ? ullTo : (ullLimitRequested ? ullLimitRequested : DEFAULT_UPPER_LIMIT);
+        return runCoordinator(coordinatorAddress, lo, hi, cChunk, cSpawn, cThreadsRequested ? cThreadsRequested : 1,
+            cSegmentBytes, workerTimeout, bQuiet, bPrintPrimes);
+    }
+
+    if(!batchPath.empty()) {
+        auto cThreads = (cThreadsRequested ? cThreadsRequested : max(1u, thread::hardware_concurrency()));
+        return runBatch(batchPath, cThreads, cSegmentBytes, bQuiet);
+    }
+
+    if(!loadPath.empty())
+        return runLoadSieve(loadPath, bVerify, bQuiet, bPrintPrimes);
+
+    // Without an explicit engine or thread count, use what --tune found best for this limit (or the nearest
+    // one it was run for).  Not for -q sweeps or --bench, whose output doesn't name the engine, so they always
+    // measure what was asked for.
+    tuned_config tuned;
+    auto bTuned = false;
+    if(bUseTuneFile && !bQuiet && !bBench && !bOneshot && !bRange && !bBucket && !bCooperative && engines.empty() && cTrancheSize == 0
+       && cThreadsRequested == 0 && cSegmentBytes == 0
+       && findTunedConfig(tuneFile, ullLimitRequested ? ullLimitRequested : DEFAULT_UPPER_LIMIT, tuned)) {
+        if (tuned.engine != "basic" && findEngine(tuned.engine))
+            engines.push_back(tuned.engine);
+        else if (tuned.engine == "tranches")
+            cTrancheSize = tuned.segment ? tuned.segment : prime_sieve_tranches::defaultTrancheSize();
+        else if (tuned.engine == "cooperative") {
+            bCooperative  = true;
+            cSegmentBytes = tuned.segment;
+        }
+        if (tuned.engine != "tranches")
+            cThreadsRequested = tuned.threads;
+        if (!bAffinitySet)
+            parseAffinity(tuned.affinity, defaultAffinity());
+        bTuned = true;
+    }
+
+    if(cTrancheSize > 0 && cThreadsRequested > 1) {
+        cout << "only one of --tranches or --threads can be specified" << endl;
+        return 0;
+    }
+
+    if(cTrancheSize > 0 && bCooperative) {
+        cout << "only one of --tranches or --cooperative can be specified" << endl;
+        return 0;
+    }
+
+    if(!engines.empty() && (bCooperative || cTrancheSize > 0)) {
+        cout << "--engine, --words, --fixed and --wheel cannot be combined with --cooperative or --tranches" << endl;
+        return 0;
+    }
+
+    if(bRange) {
+        if(bCooperative || !engines.empty() || cTrancheSize > 0 || ullLimitRequested) {
+            cout << "--from/--to cannot be combined with --limit or another engine" << endl;
+            return 0;
+        }
+        auto cThreads = (cThreadsRequested ? cThreadsRequested : max(1u, thread::hardware_concurrency()));
+        return runRangeSieve(ullFrom, ullTo, cSecondsRequested ? cSecondsRequested : 5, bOneshot, cThreads, cSegmentBytes, bQuiet, bPrintPrimes);
+    }
+
+    if(bPrintPrimes && (bBucket || find(engines.begin(), engines.end(), "bucket") != engines.end())) {
+        cout << "the bucket engine only counts, and cannot be combined with --print" << endl;
+        return 0;
+    }
+
+    if(bBucket) {
+        if(bCooperative || !engines.empty() || cTrancheSize > 0) {
+            cout << "--bucket cannot be combined with another engine" << endl;
+            return 0;
+        }
+        if(!bBench) {
+            auto cThreads = (cThreadsRequested ? cThreadsRequested : max(1u, thread::hardware_concurrency()));
+            return runBucketSieve(ullLimitRequested ? ullLimitRequested : DEFAULT_UPPER_LIMIT, cSecondsRequested ? cSecondsRequested : 5,
+                bOneshot, cThreads, cSegmentBytes, bQuiet);
+        }
+    }
+
+    if(bBench) {
+        if(bOneshot || bPrintPrimes) {
+            cout << "--bench cannot be combined with --oneshot or --print" << endl;
+            return 2;
+        }
+
+        tuned_config config;
+        config.limit    = ullLimitRequested ? ullLimitRequested : DEFAULT_UPPER_LIMIT;
+        config.threads  = cThreadsRequested ? cThreadsRequested : max(1u, thread::hardware_concurrency());
+        config.affinity = affinityName(defaultAffinity());
+        if (cSecondsRequested)
+            benchOptions.trialSeconds = cSecondsRequested;
+
+        vector<tuned_config> configs;
+        if (bCooperative) {
+            config.engine  = "cooperative";
+            config.segment = cSegmentBytes;
+            configs.push_back(config);
+        } else if (cTrancheSize > 0) {
+            config.engine  = "tranches";
+            config.threads = 1;
+            config.segment = cTrancheSize;
+            configs.push_back(config);
+        } else if (bBucket) {
+            config.engine  = "bucket";
+            config.segment = cSegmentBytes;
+            configs.push_back(config);
+        } else if (!engines.empty()) {
+            for (auto &engine : engines) {
+                tuned_config engineConfig = config;
+                engineConfig.engine = engine;
+                if (engine == "tranches")
+                    engineConfig.threads = 1;
+                else if (engine == "cooperative" || engine == "bucket")
+                    engineConfig.segment = cSegmentBytes;
+                configs.push_back(engineConfig);
+            }
+        } else {
+            config.engine = "basic";
+            configs.push_back(config);
+        }
+        return runBenchmark(configs, benchOptions);
+    }
+
+    if (!bQuiet)
+    {
+        cout << "Primes Benchmark (c) 2021 Dave's Garage - http://github.com/davepl/primes" << endl;
+        cout << "-------------------------------------------------------------------------" << endl;
+    }
+
+    if (bOneshot)
+        cout << "Oneshot is on" << endl;
+
+    if (bTuned)
+        cerr << "Using " << tuned.describe() << " from " << tuneFile << " (tuned for limit " << tuned.limit << ")" << endl;
+
+    if (bOneshot && (cSecondsRequested > 0 || (cThreadsRequested > 1 && !bCooperative)))   
+    {
+        cout << "Oneshot option cannot be mixed with second count or thread count." << endl;
+        return 0;
+    }
+
+    // A oneshot run is a single sieve on a single thread, unless it is a cooperative one
+    if (bOneshot && !bCooperative)
+        cThreadsRequested = 1;
+
+    auto result = 0;
+    auto cSeconds     = (cSecondsRequested ? cSecondsRequested : 5);
+    auto cThreads     = (cThreadsRequested ? cThreadsRequested : thread::hardware_concurrency());
+    auto llUpperLimit = (ullLimitRequested ? ullLimitRequested : DEFAULT_UPPER_LIMIT);
+    if(!bQuiet) {
+        cout << "seconds " << cSeconds << ", threads " << cThreads << ", upper limit " << llUpperLimit << endl;
+    }
+
+    if(bCooperative) {
+        result = runCooperativeMode(bOneshot, bQuiet, cSeconds, cThreads, llUpperLimit, cSegmentBytes, bPrintPrimes);
+    } else if(cTrancheSize > 0) {
+        result = runTrancheMode(bOneshot, bQuiet, cSeconds, cTrancheSize, llUpperLimit, bPrintPrimes);
+    } else if(!engines.empty()) {
+        for (auto &engine : engines) {
+            if (const sieve_engine *registered = findEngine(engine))
+                result = registered->run(bOneshot, bQuiet, cSeconds, cThreads, llUpperLimit, bPrintPrimes);
+            else if (engine == "cooperative")
+                result = runCooperativeMode(bOneshot, bQuiet, cSeconds, cThreads, llUpperLimit, cSegmentBytes, bPrintPrimes);
+            else if (engine == "tranches")
+                result = runTrancheMode(bOneshot, bQuiet, cSeconds, prime_sieve_tranches::defaultTrancheSize(), llUpperLimit, bPrintPrimes);
+            else
+                result = runBucketSieve(llUpperLimit, cSeconds, bOneshot, cThreads, cSegmentBytes, bQuiet);
+        }
+    } else {
+        result = runSieveMode<prime_sieve>(bOneshot, bQuiet, cSeconds, cThreads, llUpperLimit, bPrintPrimes);
     }
 
     // On success return the count of primes found; on failure, return 0
@@ -12,6 +12,10 @@
 #include <vector>
 #include <thread>
 #include <memory>
+#include <atomic>
+
+#include "page_buffer.h"
+#include "pass_telemetry.h"
 
 using namespace std;
 using namespace std::chrono;
@@ -27,7 +31,7 @@ class prime_sieve
 {
   private:
 
-      vector<bool> Bits;                                        // Sieve data, where 1==prime, 0==not
+      vector<bool, page_allocator<bool>> Bits;                  // Sieve data, where 1==prime, 0==not
 
    public:
 
@@ -35,6 +39,15 @@ class prime_sieve
       {
       }
 
+      // reset
+      //
+      // Marks everything as a potential prime again, keeping the storage, so the sieve can be run again.
+
+      void reset()
+      {
+          Bits.assign(Bits.size(), true);
+      }
+
       ~prime_sieve()
       {
       }
@@ -72,7 +85,7 @@ class prime_sieve
 
       size_t countPrimes() const
       {
-          size_t count = (Bits.size() >= 2);                   // Count 2 as prime if within range
+          size_t count = (Bits.size() > 2);                    // Count 2 as prime if within range
           for (int i = 3; i < Bits.size(); i+=2)
               if (Bits[i])
                   count++;
@@ -85,7 +98,7 @@ class prime_sieve
 
       bool isPrime(uint64_t n) const
       {
-          if (n & 1)
+          if ((n & 1) && n < Bits.size())
               return Bits[n];
           else
               return false;
@@ -150,8 +163,6 @@ class prime_sieve
       }
 };
 
-volatile auto cPasses = 0;
-
 int main(int argc, char **argv)
 {
     vector<string> args(argv + 1, argv + argc);         // From first to last argument in the argv array
@@ -161,13 +172,14 @@ int main(int argc, char **argv)
     auto bPrintPrimes      = false;
     auto bOneshot          = false;
     auto bQuiet            = false;
+    auto liveInterval      = 0.0;
 
     // Process command-line args
 
     for (auto i = args.begin(); i != args.end(); ++i) 
     {
         if (*i == "-h" || *i == "--help") {
-              cout << "Syntax: " << argv[0] << " [-t,--threads threads] [-s,--seconds seconds] [-l,--limit limit] [-1,--oneshot] [-q,--quiet] [-h] " << endl;
+              cout << "Syntax: " << argv[0] << " [-t,--threads threads] [-s,--seconds seconds] [-l,--limit limit] [-1,--oneshot] [-q,--quiet] [--live seconds] [-h] " << endl;
             return 0;
         }
         else if (*i == "-t" || *i == "--threads") 
@@ -199,6 +211,11 @@ int main(int argc, char **argv)
         {
              bQuiet = true;
         }        
+        else if (*i == "--live") 
+        {
+            i++;
+            liveInterval = (i == args.end()) ? 0 : max(0.0, atof(i->c_str()));
+        }
         else 
         {
             fprintf(stderr, "Unknown argument: %s", i->c_str());
@@ -235,40 +252,71 @@ int main(int argc, char **argv)
             cSeconds == 1 ? "" : "s"
         );
     }
+    memory_snapshot memoryStart;
     auto tStart       = steady_clock::now();
 
     vector<thread> threadPool;
             
-    // We create N threads and give them each the job of runing the 'runSieve' method on a sieve
-    // that we create on the heap, rather than the stack, due to their possible enormity.  By using
-    // a unique_ptr it will automatically free resources as soon as its torn down.
+    // We create N threads and give each of them a sieve that we create on the heap, rather than the stack,
+    // due to its possible enormity.  The thread keeps running 'runSieve' on it, resetting it between passes
+    // so that only the first pass pays for the allocation and its page faults.  By using a unique_ptr it will
+    // automatically free resources as soon as its torn down.
+
+    // Rather than every worker reading the clock after every pass, the main thread is the timer: it sleeps
+    // until the deadline and then raises a flag that the workers poll.  Each worker counts its passes in its
+    // own padded slot of the telemetry, and only reads the clock per pass when --live wants the latencies.
+
+    auto cWorkers = bOneshot ? 1 : cThreads;
+    pass_telemetry telemetry(cWorkers, liveInterval > 0);
+    atomic<bool> bStop(false);
 
-    for (unsigned int i = 0; i < (bOneshot ? 1 :  cThreads); i++)
+    for (unsigned int i = 0; i < cWorkers; i++)
     {
-        threadPool.push_back(thread([=]
+        threadPool.push_back(thread([=, &bStop, &telemetry]
         {
-            while (duration_cast<seconds>(steady_clock::now() - tStart).count() < cSeconds)
+            std::unique_ptr<prime_sieve> sieve(new prime_sieve(llUpperLimit));
+            auto tPass = steady_clock::now();
+            for (bool bFirst = true; !bStop.load(memory_order_relaxed); bFirst = false)
             {
-                std::unique_ptr<prime_sieve>(new prime_sieve(llUpperLimit))->runSieve();
-                cPasses++;
+                if (!bFirst)
+                    sieve->reset();
+                sieve->runSieve();
+                if (telemetry.recordsLatency())
+                {
+                    auto tEnd = steady_clock::now();
+                    telemetry.recordPass(i, tEnd - tPass);
+                    tPass = tEnd;
+                }
+                else
+                    telemetry.recordPass(i);
             }
         }));
     }
 
-    // Now we wait for all of the threads to finish before we repeat
+    telemetry.runTimer(tStart, tStart + seconds(cSeconds), bStop, liveInterval);
+
+    // Now we wait for all of the threads to finish
 
     for (auto &th : threadPool) 
         th.join();
 
     auto tEnd = steady_clock::now() - tStart;
     auto duration = duration_cast<microseconds>(tEnd).count()/1000000.0;
+    auto cPasses = telemetry.totalPasses();
+    if (liveInterval > 0)
+        telemetry.printTotal(duration);
+
+    memory_snapshot memoryEnd;
     
     prime_sieve checkSieve(llUpperLimit);
     checkSieve.runSieve();
     auto result = checkSieve.validateResults() ? checkSieve.countPrimes() : 0;
   
     if (!bQuiet)
+    {
         checkSieve.printResults(bPrintPrimes, duration , cPasses, cThreads);
+        cout << memoryEnd.describeSince(memoryStart, cPasses) << endl;
+    }
     else
         cout << cPasses << ", " << duration / cPasses << endl;
 
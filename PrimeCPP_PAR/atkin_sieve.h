@@ -0,0 +1,89 @@
+// ---------------------------------------------------------------------------
+// atkin_sieve.h : Sieve of Atkin on the odd-only word layout
+// ---------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#include "bitmap_kernels.h"
+#include "word_sieve.h"
+
+// prime_sieve_atkin
+//
+// Atkin and Bernstein's sieve, in its textbook form, over the bitmap of prime_sieve_words, whose count,
+// lookups and output it shares.  An odd n is flipped once for every solution of the quadratic form that
+// matches its residue mod 12:
+//
+//     4x^2 + y^2 = n   for n % 12 in {1, 5}
+//     3x^2 + y^2 = n   for n % 12 == 7
+//     3x^2 - y^2 = n   for n % 12 == 11, with x > y
+//
+// which leaves the primes from 5 on set, along with squareful numbers, which go once the odd multiples of
+// r^2 are cleared for every r found.  2 and 3 are not reached by the forms and are set at the end.  Only odd
+// n get a bit, so y (in the first form) or one of x and y (in the others) is odd and the even half of the
+// solutions is never visited.
+
+class prime_sieve_atkin : public prime_sieve_words
+{
+  protected:
+
+      void flip(uint64_t n)
+      {
+          Words[n >> 7] ^= 1ULL << ((n >> 1) & 63);
+      }
+
+   public:
+
+      prime_sieve_atkin(uint64_t n) : prime_sieve_words(n, false)
+      {
+      }
+
+      // runSieve starts from a cleared bitmap, so there is nothing to reset
+      void reset()
+      {
+      }
+
+      void runSieve()
+      {
+          if (limit <= 2)
+              return;
+          memset(&Words[0], 0, cWords * sizeof(uint64_t));
+
+          // 4x^2 + y^2, y odd; stepping y by 2 adds 4y + 4
+          for (uint64_t x = 1; 4 * x * x + 1 < limit; x++)
+              for (uint64_t y = 1, n = 4 * x * x + 1; n < limit; n += 4 * y + 4, y += 2)
+              {
+                  uint32_t r = n % 12;
+                  if (r == 1 || r == 5)
+                      flip(n);
+              }
+
+          // 3x^2 + y^2, x and y of opposite parity
+          for (uint64_t x = 1; 3 * x * x + 1 < limit; x++)
+              for (uint64_t y = 1 + (x & 1), n = 3 * x * x + y * y; n < limit; n += 4 * y + 4, y += 2)
+                  if (n % 12 == 7)
+                      flip(n);
+
+          // 3x^2 - y^2, x > y of opposite parity; n grows as y shrinks, so y counts down from x - 1
+          for (uint64_t x = 2; 2 * x * x + 2 * x - 1 < limit; x++)
+              for (int64_t y = x - 1; y > 0; y -= 2)
+              {
+                  uint64_t n = 3 * x * x - (uint64_t) (y * y);
+                  if (n >= limit)
+                      break;
+                  if (n % 12 == 11)
+                      flip(n);
+              }
+
+          // Squareful numbers: the odd multiples of r^2, r^2 bits apart, for every r left set
+          for (uint64_t r = 5; r * r < limit; r += 2)
+              if (getBit(r >> 1))
+                  crossOffLarge(&Words[0], r * r, (r * r) >> 1, cBits);
+
+          Words[0] |= 1;                                        // Bit 0 stands in for 2
+          if (limit > 3)
+              Words[0] |= 2;
+      }
+};
@@ -0,0 +1,375 @@
+// ---------------------------------------------------------------------------
+// batch_sieve.h : Batches of counting jobs on a work-stealing pool, for --batch
+// ---------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bitmap_kernels.h"
+#include "popcount.h"
+#include "presieve.h"
+#include "prime_count.h"
+#include "sieve_common.h"
+#include "worker_pool.h"
+
+// batch_job
+//
+// One line of a batch: the primes below a limit ("count 5e9") or in a window ("range 1e12 1.001e12"), either
+// way the window [lo, hi).  The workers add to count and take bits off bitsLeft as they finish its pieces;
+// whoever takes off the last bit stamps tDone.  A job with no bits to sieve is done as it is submitted.
+
+struct batch_job
+{
+    std::string spec;                                           // The line it came from, for the report
+    uint64_t lo = 0;
+    uint64_t hi = 0;
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> bitsLeft{0};
+    std::atomic<uint64_t> busyNanos{0};                         // Summed over its pieces, on whichever thread
+    std::atomic<uint32_t> cTasks{0};
+    std::atomic<uint32_t> cStolen{0};
+    std::chrono::steady_clock::time_point tDone;
+
+    uint64_t firstBit() const
+    {
+        return std::max<uint64_t>(lo >> 1, 1);                  // Bit 0, the number 1, is never counted
+    }
+
+    uint64_t lastBit() const
+    {
+        return std::max(hi >> 1, firstBit());
+    }
+
+    bool includesTwo() const
+    {
+        return lo <= 2 && hi > 2;
+    }
+
+    bool hasWork() const
+    {
+        return lastBit() > firstBit();
+    }
+};
+
+// parseJobNumber
+//
+// A non-negative integer, optionally in the 5e9 or 1.5e12 form as long as that comes out whole.
+
+inline bool parseJobNumber(const std::string &text, uint64_t &value)
+{
+    size_t e = text.find_first_of("eE");
+    std::string mantissa = text.substr(0, e);
+    int exponent = 0;
+    if (e != std::string::npos)
+    {
+        if (e + 1 >= text.size() || text.find_first_not_of("0123456789", e + 1) != std::string::npos)
+            return false;
+        exponent = atoi(text.c_str() + e + 1);
+    }
+
+    size_t dot = mantissa.find('.');
+    std::string digits = mantissa.substr(0, dot);
+    if (dot != std::string::npos)
+    {
+        std::string fraction = mantissa.substr(dot + 1);
+        while (!fraction.empty() && fraction.back() == '0')
+            fraction.pop_back();
+        if ((int) fraction.size() > exponent)
+            return false;
+        digits += fraction;
+        exponent -= (int) fraction.size();
+    }
+    if (digits.empty() || digits.find_first_not_of("0123456789") != std::string::npos)
+        return false;
+
+    errno = 0;
+    value = strtoull(digits.c_str(), nullptr, 10);
+    if (errno == ERANGE)
+        return false;
+    for (; exponent > 0; exponent--)
+    {
+        if (value > UINT64_MAX / 10)
+            return false;
+        value *= 10;
+    }
+    return true;
+}
+
+// parseBatchJobs
+//
+// Reads job lines until the end of the stream.  Blank lines and anything after a '#' are ignored.  On a bad
+// line it stops and says which in 'error'.
+
+inline bool parseBatchJobs(std::istream &in, std::vector<std::unique_ptr<batch_job>> &jobs, std::string &error)
+{
+    std::string line;
+    for (int cLine = 1; std::getline(in, line); cLine++)
+    {
+        std::string text = line.substr(0, line.find('#'));
+        std::istringstream words(text);
+        std::string kind, first, second, extra;
+        if (!(words >> kind))
+            continue;
+        words >> first >> second >> extra;
+
+        std::unique_ptr<batch_job> job(new batch_job);
+        bool bGood = false;
+        if (kind == "count")
+            bGood = !first.empty() && second.empty() && parseJobNumber(first, job->hi);
+        else if (kind == "range")
+            bGood = !second.empty() && extra.empty() && parseJobNumber(first, job->lo) && parseJobNumber(second, job->hi)
+                 && job->lo <= job->hi;
+        if (!bGood)
+        {
+            error = "line " + std::to_string(cLine) + ": " + line;
+            return false;
+        }
+
+        job->spec = kind + " " + first + (second.empty() ? "" : " " + second);
+        jobs.push_back(std::move(job));
+    }
+    return true;
+}
+
+// batch_task
+//
+// A piece of a job, bits [firstBit, lastBit) of the odd-only number line.
+
+struct batch_task
+{
+    batch_job *job;
+    uint64_t firstBit;
+    uint64_t lastBit;
+};
+
+// steal_queue
+//
+// One worker's deque of tasks.  The owner pushes and pops at the back, so it works depth first on the
+// pieces it has just split off; thieves take from the front, where the oldest and so the largest pieces
+// are.  A lock per queue is enough: it is taken once per task of at least a few segments, and a thief only
+// ever contends with one owner.
+
+class steal_queue
+{
+  protected:
+
+      std::mutex lock;
+      std::deque<batch_task> tasks;
+
+   public:
+
+      void push(const batch_task &task)
+      {
+          std::lock_guard<std::mutex> guard(lock);
+          tasks.push_back(task);
+      }
+
+      bool pop(batch_task &task)
+      {
+          std::lock_guard<std::mutex> guard(lock);
+          if (tasks.empty())
+              return false;
+          task = tasks.back();
+          tasks.pop_back();
+          return true;
+      }
+
+      bool steal(batch_task &task)
+      {
+          std::lock_guard<std::mutex> guard(lock);
+          if (tasks.empty())
+              return false;
+          task = tasks.front();
+          tasks.pop_front();
+          return true;
+      }
+};
+
+// Pieces of a job are split until they are this many segments or fewer
+const uint64_t BATCH_GRAIN_SEGMENTS = 16;
+
+// batch_sieve
+//
+// Runs a batch of jobs on a worker pool.  The jobs are dealt out to the workers' queues in turn, whole.  A
+// worker takes the task at the back of its own queue, and while it is bigger than the grain splits it in
+// half at a segment boundary, keeps the lower half and pushes the upper one.  A big job so leaves a trail of
+// halves behind, the largest at the front where thieves look first, and the owner works through the rest
+// of them from the small end.  With nothing of its own left, a worker tries every other queue in turn, and
+// yields if all are empty until the last job is done.
+//
+// Each piece is sieved and counted one segment at a time in the worker's own buffer, with the seed primes
+// up to the square root of the largest hi, found once for the whole batch.  Segments lie on a fixed grid of
+// absolute bit indexes, so the presieve tile and every prime's phase line up whatever job they belong to.
+
+class batch_sieve
+{
+  protected:
+
+      std::vector<uint32_t> seedPrimes;                         // Odd primes past the presieve, up to sqrt(max hi - 1)
+      uint64_t cSegmentBits;
+
+      // countPiece
+      //
+      // Primes 2b + 1 for b in [firstBit, lastBit), one segment of the grid at a time.
+
+      uint64_t countPiece(uint64_t firstBit, uint64_t lastBit, uint64_t *segment) const
+      {
+          uint64_t found = 0;
+          for (uint64_t segmentFirst = firstBit & ~(cSegmentBits - 1); segmentFirst < lastBit; segmentFirst += cSegmentBits)
+          {
+              uint64_t segmentLast = std::min(segmentFirst + cSegmentBits, lastBit);
+              uint64_t segmentBits = segmentLast - segmentFirst;
+              uint64_t baseWord    = segmentFirst >> 6;
+              presieve_pattern::get().fill(segment, 0, (segmentBits + 63) >> 6, baseWord);
+
+              for (uint64_t p : seedPrimes)
+              {
+                  uint64_t num = (p * p) >> 1;
+                  if (num >= segmentLast)
+                      break;
+                  if (num < segmentFirst)
+                  {
+                      uint64_t r = (segmentFirst - (p >> 1)) % p;
+                      num = segmentFirst + (r ? p - r : 0);
+                  }
+                  if (num < segmentLast)
+                      crossOff(segment, p, num - segmentFirst, segmentBits, baseWord);
+              }
+
+              found += countBits(segment, std::max(firstBit, segmentFirst) - segmentFirst, segmentBits);
+          }
+          return found;
+      }
+
+      // Returns true for the task that finishes its job
+      bool runTask(const batch_task &task, uint64_t *segment) const
+      {
+          auto tStart = std::chrono::steady_clock::now();
+          uint64_t found = countPiece(task.firstBit, task.lastBit, segment);
+          auto nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - tStart).count();
+
+          batch_job &job = *task.job;
+          job.count += found;
+          job.busyNanos += nanos;
+          job.cTasks++;
+          uint64_t cBits = task.lastBit - task.firstBit;
+          if (job.bitsLeft.fetch_sub(cBits, std::memory_order_acq_rel) != cBits)
+              return false;
+          job.tDone = std::chrono::steady_clock::now();
+          return true;
+      }
+
+   public:
+
+      uint64_t cSteals = 0;                                     // Tasks taken from another worker's queue, last run
+
+      batch_sieve(size_t segmentBytes)
+      {
+          // A power of two bits of at least a word, so the grid is word aligned
+          cSegmentBits = 64;
+          while (cSegmentBits * 2 <= segmentBytes * 8)
+              cSegmentBits *= 2;
+      }
+
+      uint64_t segmentBytes() const
+      {
+          return cSegmentBits >> 3;
+      }
+
+      // computeSeedPrimes
+      //
+      // Everything the jobs up to maxHi need; done apart from run() so it can be timed on its own.
+
+      void computeSeedPrimes(uint64_t maxHi)
+      {
+          uint64_t q = maxHi > 1 ? integerRoot(maxHi - 1, 2) : 0;
+          uint32_t largest = presieve_pattern::get().largestPrime();
+          seedPrimes.clear();
+          small_prime_table(q).forEachPrime(3, q, [&](uint64_t p)
+          {
+              if (p > largest)
+                  seedPrimes.push_back((uint32_t) p);
+          });
+      }
+
+      size_t seedPrimeCount() const
+      {
+          return seedPrimes.size();
+      }
+
+      // run
+      //
+      // Counts every job; tStart is when they count as submitted, for their latency.
+
+      void run(std::vector<std::unique_ptr<batch_job>> &jobs, worker_pool &pool, std::chrono::steady_clock::time_point tStart)
+      {
+          unsigned int cWorkers = pool.size();
+          std::unique_ptr<steal_queue[]> queues(new steal_queue[cWorkers]);
+          std::atomic<size_t> jobsLeft(0);
+          std::atomic<uint64_t> steals(0);
+
+          // Dealt out last job first, as the owners work from the back
+          for (size_t j = jobs.size(); j-- > 0; )
+          {
+              batch_job &job = *jobs[j];
+              job.count = job.includesTwo();
+              job.bitsLeft = job.lastBit() - job.firstBit();
+              if (!job.hasWork())
+              {
+                  job.tDone = tStart;
+                  continue;
+              }
+              jobsLeft++;
+              queues[j % cWorkers].push({ &job, job.firstBit(), job.lastBit() });
+          }
+
+          const uint64_t grainBits = BATCH_GRAIN_SEGMENTS * cSegmentBits;
+          pool.run([&](unsigned int i)
+          {
+              std::unique_ptr<uint64_t[]> segment(new uint64_t[cSegmentBits >> 6]);
+              batch_task task;
+              while (jobsLeft.load(std::memory_order_acquire) > 0)
+              {
+                  bool bFound = queues[i].pop(task);
+                  for (unsigned int k = 1; !bFound && k < cWorkers; k++)
+                  {
+                      if ((bFound = queues[(i + k) % cWorkers].steal(task)))
+                      {
+                          task.job->cStolen++;
+                          steals++;
+                      }
+                  }
+                  if (!bFound)
+                  {
+                      std::this_thread::yield();
+                      continue;
+                  }
+
+                  while (task.lastBit - task.firstBit > grainBits)
+                  {
+                      uint64_t mid = ((task.firstBit + task.lastBit) / 2) & ~(cSegmentBits - 1);
+                      queues[i].push({ task.job, mid, task.lastBit });
+                      task.lastBit = mid;
+                  }
+
+                  if (runTask(task, segment.get()))
+                      jobsLeft--;
+              }
+          });
+          cSteals = steals;
+      }
+};
@@ -0,0 +1,300 @@
+// ---------------------------------------------------------------------------
+// bench_harness.h : Trial statistics, result records and baseline comparison for --bench
+// ---------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+// trial_stats
+//
+// Summary of the passes-per-second samples of one configuration.  Outliers are samples more than
+// OUTLIER_MADS scaled median absolute deviations from the median; mean and stddev are over what remains.
+
+struct trial_stats
+{
+    static constexpr double OUTLIER_MADS = 3.0;
+
+    size_t cSamples = 0;
+    size_t cKept = 0;
+    double median = 0;
+    double mean = 0;
+    double stddev = 0;
+    double min = 0;
+    double max = 0;
+
+    static double medianOf(std::vector<double> values)
+    {
+        if (values.empty())
+            return 0;
+        std::sort(values.begin(), values.end());
+        size_t mid = values.size() / 2;
+        return values.size() & 1 ? values[mid] : (values[mid - 1] + values[mid]) / 2;
+    }
+
+    static trial_stats summarize(const std::vector<double> &samples)
+    {
+        trial_stats stats;
+        stats.cSamples = samples.size();
+        if (samples.empty())
+            return stats;
+
+        stats.median = medianOf(samples);
+
+        // 1.4826 * MAD estimates the standard deviation of normally distributed samples
+        std::vector<double> deviations;
+        for (double x : samples)
+            deviations.push_back(fabs(x - stats.median));
+        double spread = 1.4826 * medianOf(deviations);
+
+        std::vector<double> kept;
+        for (double x : samples)
+            if (spread == 0 || fabs(x - stats.median) <= OUTLIER_MADS * spread)
+                kept.push_back(x);
+
+        stats.cKept = kept.size();
+        stats.min = *std::min_element(kept.begin(), kept.end());
+        stats.max = *std::max_element(kept.begin(), kept.end());
+        for (double x : kept)
+            stats.mean += x;
+        stats.mean /= kept.size();
+        for (double x : kept)
+            stats.stddev += (x - stats.mean) * (x - stats.mean);
+        stats.stddev = kept.size() > 1 ? sqrt(stats.stddev / (kept.size() - 1)) : 0;
+        return stats;
+    }
+};
+
+inline std::string hostName()
+{
+    char name[256] = {};
+    if (gethostname(name, sizeof(name) - 1) != 0)
+        return "unknown";
+    return name;
+}
+
+// cpuModelName
+//
+// The "model name" line of /proc/cpuinfo, which is where Linux keeps the marketing name of the CPU.
+
+inline std::string cpuModelName()
+{
+    std::ifstream cpuinfo("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(cpuinfo, line))
+    {
+        if (line.compare(0, 10, "model name") != 0)
+            continue;
+        auto colon = line.find(':');
+        if (colon == std::string::npos)
+            break;
+        auto start = line.find_first_not_of(" \t", colon + 1);
+        return start == std::string::npos ? "unknown" : line.substr(start);
+    }
+    return "unknown";
+}
+
+// bench_record
+//
+// One benchmarked configuration: where it ran, what ran, and its passes-per-second statistics.  Records are
+// written as JSON lines or CSV, and the CSV form doubles as the baseline file format.
+
+struct bench_record
+{
+    std::string host;
+    std::string cpu;
+    std::string engine;
+    uint64_t limit = 0;
+    unsigned int threads = 1;
+    uint64_t segment = 0;
+    std::string affinity = "none";
+    unsigned int warmup = 0;
+    trial_stats stats;
+    bool bValid = false;
+
+    static const char *csvHeader()
+    {
+        return "host,cpu,engine,limit,threads,segment,affinity,warmup,trials,kept,median,mean,stddev,min,max,valid";
+    }
+
+    bool sameConfig(const bench_record &other) const
+    {
+        return engine == other.engine && limit == other.limit && threads == other.threads
+            && segment == other.segment && affinity == other.affinity;
+    }
+
+    std::string toCsv() const
+    {
+        // The CSV is only ever split on commas, so strip them from the free-form fields.  A cpu-list affinity
+        // has to survive the round trip for sameConfig, so its commas become semicolons and fromCsv turns
+        // them back.
+        auto clean = [](std::string s) { std::replace(s.begin(), s.end(), ',', ' '); return s; };
+        auto escapedAffinity = affinity;
+        std::replace(escapedAffinity.begin(), escapedAffinity.end(), ',', ';');
+
+        std::ostringstream out;
+        out.precision(10);
+        out << clean(host) << "," << clean(cpu) << "," << engine << "," << limit << "," << threads << ","
+            << segment << "," << escapedAffinity << "," << warmup << "," << stats.cSamples << "," << stats.cKept << ","
+            << stats.median << "," << stats.mean << "," << stats.stddev << "," << stats.min << "," << stats.max
+            << "," << (bValid ? "true" : "false");
+        return out.str();
+    }
+
+    std::string toJson() const
+    {
+        auto quote = [](const std::string &s)
+        {
+            std::string out = "\"";
+            for (char c : s)
+            {
+                if (c == '"' || c == '\\')
+                    out += '\\';
+                out += c;
+            }
+            return out + "\"";
+        };
+
+        std::ostringstream out;
+        out.precision(10);
+        out << "{\"host\":" << quote(host) << ",\"cpu\":" << quote(cpu) << ",\"engine\":" << quote(engine)
+            << ",\"limit\":" << limit << ",\"threads\":" << threads << ",\"segment\":" << segment
+            << ",\"affinity\":" << quote(affinity) << ",\"warmup\":" << warmup << ",\"trials\":" << stats.cSamples
+            << ",\"kept\":" << stats.cKept << ",\"median\":" << stats.median << ",\"mean\":" << stats.mean
+            << ",\"stddev\":" << stats.stddev << ",\"min\":" << stats.min << ",\"max\":" << stats.max
+            << ",\"valid\":" << (bValid ? "true" : "false") << "}";
+        return out.str();
+    }
+
+    static bool fromCsv(const std::string &line, bench_record &record)
+    {
+        std::vector<std::string> fields;
+        std::istringstream in(line);
+        std::string field;
+        while (std::getline(in, field, ','))
+            fields.push_back(field);
+        if (fields.size() != 16 || fields[0] == "host")
+            return false;
+
+        record.host           = fields[0];
+        record.cpu            = fields[1];
+        record.engine         = fields[2];
+        record.limit          = strtoull(fields[3].c_str(), nullptr, 10);
+        record.threads        = (unsigned int) atoi(fields[4].c_str());
+        record.segment        = strtoull(fields[5].c_str(), nullptr, 10);
+        record.affinity       = fields[6];
+        std::replace(record.affinity.begin(), record.affinity.end(), ';', ',');
+        record.warmup         = (unsigned int) atoi(fields[7].c_str());
+        record.stats.cSamples = strtoull(fields[8].c_str(), nullptr, 10);
+        record.stats.cKept    = strtoull(fields[9].c_str(), nullptr, 10);
+        record.stats.median   = atof(fields[10].c_str());
+        record.stats.mean     = atof(fields[11].c_str());
+        record.stats.stddev   = atof(fields[12].c_str());
+        record.stats.min      = atof(fields[13].c_str());
+        record.stats.max      = atof(fields[14].c_str());
+        record.bValid         = fields[15] == "true";
+        return true;
+    }
+};
+
+inline std::vector<bench_record> loadBaseline(const std::string &path)
+{
+    std::vector<bench_record> records;
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line))
+    {
+        bench_record record;
+        if (bench_record::fromCsv(line, record))
+            records.push_back(record);
+    }
+    return records;
+}
+
+inline bool saveBaseline(const std::string &path, const std::vector<bench_record> &records)
+{
+    std::ofstream out(path, std::ios::trunc);
+    if (!out)
+        return false;
+    out << bench_record::csvHeader() << std::endl;
+    for (const auto &record : records)
+        out << record.toCsv() << std::endl;
+    return (bool) out;
+}
+
+// benchmark_baseline
+//
+// The baseline loaded with --compare-baseline, if any, so that the --quiet sweeps can show their speed
+// relative to it.
+
+struct benchmark_baseline
+{
+    std::vector<bench_record> records;
+
+    static benchmark_baseline &get()
+    {
+        static benchmark_baseline baseline;
+        return baseline;
+    }
+
+    const bench_record *find(const std::string &engine, uint64_t limit, unsigned int threads) const
+    {
+        for (const auto &record : records)
+            if (record.engine == engine && record.limit == limit && record.threads == threads)
+                return &record;
+        return nullptr;
+    }
+};
+
+// regressionTest
+//
+// Welch's t-test on the trial means: is the current run slower than the baseline with 99% one-sided
+// confidence?  The critical t for the Welch-Satterthwaite degrees of freedom uses the Cornish-Fisher
+// expansion around the normal quantile, which is plenty accurate for the handful of trials we take.
+// Returns the relative change of the median so callers can report it either way.
+
+inline bool regressionTest(const trial_stats &baseline, const trial_stats &current, double &change)
+{
+    change = baseline.median > 0 ? current.median / baseline.median - 1 : 0;
+    if (baseline.cKept < 2 || current.cKept < 2)
+        return false;
+
+    double vb = baseline.stddev * baseline.stddev / baseline.cKept;
+    double vc = current.stddev * current.stddev / current.cKept;
+    if (vb + vc == 0)
+        return current.mean < baseline.mean;
+
+    double t  = (baseline.mean - current.mean) / sqrt(vb + vc);
+    double df = (vb + vc) * (vb + vc)
+              / (vb * vb / (baseline.cKept - 1) + vc * vc / (current.cKept - 1));
+
+    const double z = 2.3263;                                    // One-sided 99% normal quantile
+    double tCritical = z + (z * z * z + z) / (4 * df)
+                     + (5 * pow(z, 5) + 16 * z * z * z + 3 * z) / (96 * df * df);
+    return t > tCritical;
+}
+
+// bench_options
+//
+// How --bench runs and where its records go, as chosen on the command line.
+
+struct bench_options
+{
+    unsigned int cWarmup = 2;                                   // Trials run and discarded before measuring
+    unsigned int cTrials = 10;
+    double trialSeconds = 1;
+    bool bCsv = false;                                          // JSON lines unless --bench-format csv
+    std::string outputPath;                                     // Empty means stdout
+    std::string recordPath;                                     // --record-baseline
+    std::string comparePath;                                    // --compare-baseline
+};
@@ -0,0 +1,116 @@
+// ---------------------------------------------------------------------------
+// bitmap_kernels.h : Cross-off kernels for odd-only sieves stored in raw 64-bit words
+// ---------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// All the word-based engines use the same layout as prime_sieve: bit i stands for the odd number 2i+1, so the
+// multiples of an odd prime p sit at bit indexes congruent to (p-1)/2 modulo p, starting at (p*p-1)/2.
+
+const uint64_t SMALL_STRIDE_LIMIT = 64;                         // Primes below this get rotating word masks
+
+// small_stride_masks
+//
+// For an odd prime p < 64 the pattern of its multiples repeats every p words (64*p bits), so we precompute
+// those p words once.  Word k of the pattern has a 0 wherever bit 64k+b is a multiple of p; crossing off a
+// whole word is then a single AND with the next mask in the rotation.
+
+class small_stride_masks
+{
+  protected:
+
+      std::vector<uint64_t> masks;
+      uint32_t offsets[SMALL_STRIDE_LIMIT];
+
+      small_stride_masks()
+      {
+          for (uint64_t p = 3; p < SMALL_STRIDE_LIMIT; p += 2)
+          {
+              offsets[p] = (uint32_t) masks.size();
+              for (uint64_t k = 0; k < p; k++)
+              {
+                  uint64_t mask = ~0ULL;
+                  for (uint64_t b = 0; b < 64; b++)
+                      if (((k << 6) + b) % p == (p >> 1))
+                          mask &= ~(1ULL << b);
+                  masks.push_back(mask);
+              }
+          }
+      }
+
+   public:
+
+      static const small_stride_masks &get()
+      {
+          static const small_stride_masks table;
+          return table;
+      }
+
+      // The p masks for prime p, indexed by word number modulo p
+      const uint64_t *forPrime(uint64_t p) const
+      {
+          return &masks[offsets[p]];
+      }
+};
+
+// crossOffSmall
+//
+// Clears every multiple of p (p < 64) at bit indexes [first, last), where first is itself a multiple.  The
+// first word is masked so we never touch the bits below 'first'; bits past 'last' in the final word may get
+// cleared too, which is harmless since they are multiples of p beyond p*p as well.  As with
+// presieve_pattern::fill, a bitmap that doesn't start at 1 passes baseWord, the absolute index of its word 0,
+// so the masks line up with the numbers.
+
+inline void crossOffSmall(uint64_t *words, uint64_t p, uint64_t first, uint64_t last, uint64_t baseWord = 0)
+{
+    if (first >= last)
+        return;
+
+    const uint64_t *pattern = small_stride_masks::get().forPrime(p);
+    uint64_t word    = first >> 6;
+    uint64_t endWord = (last + 63) >> 6;
+    uint64_t phase   = (baseWord + word) % p;
+
+    words[word] &= pattern[phase] | ((1ULL << (first & 63)) - 1);
+    for (word++, phase++; word < endWord; word++, phase++)
+    {
+        if (phase == p)
+            phase = 0;
+        words[word] &= pattern[phase];
+    }
+}
+
+// crossOffLarge
+//
+// Plain strided bit clear for the wider primes, unrolled four ways so the independent stores can overlap.
+// Returns the first multiple at or past 'last', where a segmented sieve carries on next time.
+
+inline uint64_t crossOffLarge(uint64_t *words, uint64_t step, uint64_t num, uint64_t last)
+{
+    const uint64_t step4 = step << 2;
+    for (; num + 3 * step < last; num += step4)
+    {
+        words[num >> 6]              &= ~(1ULL << (num & 63));
+        words[(num + step) >> 6]     &= ~(1ULL << ((num + step) & 63));
+        words[(num + 2 * step) >> 6] &= ~(1ULL << ((num + 2 * step) & 63));
+        words[(num + 3 * step) >> 6] &= ~(1ULL << ((num + 3 * step) & 63));
+    }
+    for (; num < last; num += step)
+        words[num >> 6] &= ~(1ULL << (num & 63));
+    return num;
+}
+
+// crossOff
+//
+// Picks the kernel for prime p.  'first' must be the bit index of a multiple of p.
+
+inline void crossOff(uint64_t *words, uint64_t p, uint64_t first, uint64_t last, uint64_t baseWord = 0)
+{
+    if (p < SMALL_STRIDE_LIMIT)
+        crossOffSmall(words, p, first, last, baseWord);
+    else
+        crossOffLarge(words, p, first, last);
+}
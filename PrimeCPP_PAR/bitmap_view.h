@@ -0,0 +1,65 @@
+// ---------------------------------------------------------------------------
+// bitmap_view.h : Read-only view of an odd-only sieve bitmap, wherever its words live
+// ---------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+
+#include "popcount.h"
+#include "prime_writer.h"
+
+// bitmap_view
+//
+// The finished bitmap of prime_sieve_words or prime_sieve_segmented - bit i stands for 2i+1, bit 0 left set
+// in place of 2 - without owning it.  Lets the same queries run on a sieve in memory and on one mapped
+// from a sieve file.
+
+struct bitmap_view
+{
+    const uint64_t *words = nullptr;
+    uint64_t limit = 0;
+    uint64_t cBits = 0;
+
+    uint64_t cWords() const
+    {
+        return (cBits + 63) >> 6;
+    }
+
+    bool isPrime(uint64_t n) const
+    {
+        if (n == 2)
+            return limit > 2;
+        if (!(n & 1) || n == 1 || n >= limit)
+            return false;
+        return (words[n >> 7] >> ((n >> 1) & 63)) & 1;
+    }
+
+    size_t countPrimes() const
+    {
+        if (limit <= 2)
+            return 0;
+        return countBits(words, 0, cBits);
+    }
+
+    // Primes in [lo, hi)
+    size_t countPrimes(uint64_t lo, uint64_t hi) const
+    {
+        hi = std::min(hi, limit);
+        if (lo >= hi)
+            return 0;
+        size_t count = (lo <= 2 && hi > 2);
+        return count + countBits(words, std::max<uint64_t>(lo, 3) >> 1, hi >> 1);
+    }
+
+    void printPrimes() const
+    {
+        prime_writer writer;
+        if (limit > 2)
+            writer.put(2);
+        writer.putOddBits(words, 1, cBits);
+        writer.finish();
+    }
+};
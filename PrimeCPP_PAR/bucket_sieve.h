@@ -0,0 +1,370 @@
+// ---------------------------------------------------------------------------
+// bucket_sieve.h : Count-only segmented sieve with bucketed large primes, for limits of 1e10 and up
+// ---------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "bitmap_kernels.h"
+#include "perf_profile.h"
+#include "popcount.h"
+#include "presieve.h"
+#include "prime_count.h"
+#include "sieve_common.h"
+#include "worker_pool.h"
+
+// bucket_entry / bucket_block
+//
+// A large prime waiting for the segment it next hits: the prime and the bit of that segment.  Entries are
+// kept in blocks of 8 KB, so filing one is a store and a bump, and a whole block goes back to the free list
+// once its segment has been sieved.
+
+struct bucket_entry
+{
+    uint32_t prime;
+    uint32_t offset;                                            // Bit within the segment the entry is filed under
+};
+
+const uint32_t BUCKET_BLOCK_ENTRIES = 1022;
+
+struct bucket_block
+{
+    bucket_block *next;
+    uint64_t cEntries;
+    bucket_entry entries[BUCKET_BLOCK_ENTRIES];
+};
+
+// bucket_ring
+//
+// One bucket per segment for the next few segments, indexed by segment number modulo a power of two.  A
+// prime of at least one segment's worth of bits hits a segment at most once, and its next multiple is never
+// more than p bits on, so a ring that spans the largest prime is enough.  Every large prime is filed in
+// exactly one bucket at a time, so the blocks in use never exceed the number of large primes over the block
+// size, plus one part-filled block per bucket.
+
+class bucket_ring
+{
+  protected:
+
+      std::vector<bucket_block *> heads;                        // Newest block of each bucket, filled first
+      std::vector<std::unique_ptr<bucket_block>> blocks;        // Every block allocated, for cleaning up
+      bucket_block *freeBlocks = nullptr;
+      uint64_t mask;
+
+      bucket_block *newBlock(bucket_block *next)
+      {
+          bucket_block *block = freeBlocks;
+          if (block)
+              freeBlocks = block->next;
+          else
+          {
+              blocks.emplace_back(new bucket_block);
+              block = blocks.back().get();
+          }
+          block->next = next;
+          block->cEntries = 0;
+          return block;
+      }
+
+   public:
+
+      explicit bucket_ring(uint64_t cSegmentsAhead)
+      {
+          uint64_t cBuckets = 1;
+          while (cBuckets < cSegmentsAhead + 1)
+              cBuckets <<= 1;
+          heads.assign(cBuckets, nullptr);
+          mask = cBuckets - 1;
+      }
+
+      void push(uint64_t segment, uint32_t prime, uint32_t offset)
+      {
+          bucket_block *&head = heads[segment & mask];
+          if (!head || head->cEntries == BUCKET_BLOCK_ENTRIES)
+              head = newBlock(head);
+          head->entries[head->cEntries++] = { prime, offset };
+      }
+
+      // Detaches the bucket of a segment; its blocks go back with release() once they have been walked
+      bucket_block *take(uint64_t segment)
+      {
+          bucket_block *list = heads[segment & mask];
+          heads[segment & mask] = nullptr;
+          return list;
+      }
+
+      void release(bucket_block *block)
+      {
+          block->next = freeBlocks;
+          freeBlocks = block;
+      }
+
+      // Empties every bucket, keeping the blocks for reuse
+      void clear()
+      {
+          for (auto &head : heads)
+          {
+              while (head)
+              {
+                  bucket_block *next = head->next;
+                  release(head);
+                  head = next;
+              }
+          }
+      }
+
+      size_t allocatedBytes() const
+      {
+          return blocks.size() * sizeof(bucket_block) + heads.size() * sizeof(bucket_block *);
+      }
+};
+
+// prime_sieve_bucket
+//
+// Counts the primes below the limit one segment at a time, without ever holding more than a segment of the
+// bitmap, after Oliveira e Silva's bucket sieve.  Seed primes below the segment size in bits hit every
+// segment and are crossed off in each as prime_sieve_segmented does, from a saved next multiple.  The larger
+// ones hit a given segment at most once, so rather than visiting every one of them for every segment, each
+// is filed in the bucket of the segment it next hits; sieving a segment walks only its own bucket and files
+// each prime again further on.  Large primes are only filed once the sieve reaches their square.
+//
+// Memory is the segment buffer and the ring per thread, plus the seed primes: a few MB at 1e14.  The threads
+// split the segments into runs that they claim one at a time, each run starting its primes from scratch.
+// Segments are a power of two bits long, from the L1 cache size by default.
+
+class prime_sieve_bucket
+{
+  protected:
+
+      std::vector<uint32_t> seedPrimes;                         // Odd primes past the presieve, up to sqrt(limit - 1)
+      size_t cMediumPrimes = 0;                                 // How many of them are below cSegmentBits
+      uint64_t limit;
+      uint64_t cBits;
+      uint64_t cSegmentBits;
+      unsigned int cSegmentShift;
+      unsigned int cThreads;
+      uint64_t count = 0;
+      size_t bucketBytes = 0;                                   // The most any thread's ring grew to
+
+      void computeSeedPrimes()
+      {
+          uint64_t q = limit > 1 ? integerRoot(limit - 1, 2) : 0;
+          uint32_t largest = presieve_pattern::get().largestPrime();
+          seedPrimes.clear();
+          small_prime_table(q).forEachPrime(3, q, [&](uint64_t p)
+          {
+              if (p > largest)
+                  seedPrimes.push_back((uint32_t) p);
+          });
+          cMediumPrimes = std::lower_bound(seedPrimes.begin(), seedPrimes.end(), cSegmentBits) - seedPrimes.begin();
+      }
+
+      // The first multiple of p at or past both p*p and bit 'from', as a bit index
+      static uint64_t firstMultiple(uint64_t p, uint64_t from)
+      {
+          uint64_t num = (p * p) >> 1;
+          if (num < from)
+          {
+              uint64_t r = (from - (p >> 1)) % p;
+              num = from + (r ? p - r : 0);
+          }
+          return num;
+      }
+
+      // countSegments
+      //
+      // Sieves and counts segments [firstSegment, lastSegment) with the given buffer and ring.  With --profile
+      // the fill, the two kinds of medium prime, the bucket walk and the count are separate phases.
+
+      uint64_t countSegments(uint64_t firstSegment, uint64_t lastSegment, uint64_t *segment, bucket_ring &ring) const
+      {
+          uint64_t lastBit = std::min(lastSegment << cSegmentShift, cBits);
+
+          std::vector<uint64_t> mediumNext(cMediumPrimes);
+          for (size_t i = 0; i < cMediumPrimes; i++)
+              mediumNext[i] = firstMultiple(seedPrimes[i], firstSegment << cSegmentShift);
+
+          ring.clear();
+          size_t nextLarge = cMediumPrimes;
+          uint64_t found = 0;
+
+          for (uint64_t s = firstSegment; s < lastSegment; s++)
+          {
+              uint64_t segmentFirst = s << cSegmentShift;
+              uint64_t segmentBits  = std::min(cSegmentBits, lastBit - segmentFirst);
+              uint64_t baseWord     = segmentFirst >> 6;
+
+              profile_phase phase(PHASE_INIT);
+              presieve_pattern::get().fill(segment, 0, (segmentBits + 63) >> 6, baseWord);
+
+              phase.switchTo(PHASE_SMALL_PRIMES);
+              bool bLargePrimes = false;
+              for (size_t i = 0; i < cMediumPrimes; i++)
+              {
+                  uint64_t p = seedPrimes[i], num = mediumNext[i];
+                  if (num >= segmentFirst + segmentBits)
+                  {
+                      if (((p * p) >> 1) >= lastBit)
+                          break;
+                      continue;
+                  }
+                  if (p < SMALL_STRIDE_LIMIT)
+                  {
+                      crossOffSmall(segment, p, num - segmentFirst, segmentBits, baseWord);
+                      mediumNext[i] = num + (segmentFirst + segmentBits - num + p - 1) / p * p;
+                  }
+                  else
+                  {
+                      if (!bLargePrimes)
+                      {
+                          phase.switchTo(PHASE_LARGE_PRIMES);
+                          bLargePrimes = true;
+                      }
+                      mediumNext[i] = segmentFirst + crossOffLarge(segment, p, num - segmentFirst, segmentBits);
+                  }
+              }
+
+              // File the large primes whose square has come into reach, then sieve this segment's bucket
+              phase.switchTo(PHASE_LARGE_PRIMES);
+              for (; nextLarge < seedPrimes.size(); nextLarge++)
+              {
+                  uint64_t p = seedPrimes[nextLarge];
+                  if (((p * p) >> 1) >= segmentFirst + cSegmentBits)
+                      break;
+                  uint64_t num = firstMultiple(p, segmentFirst);
+                  ring.push(num >> cSegmentShift, (uint32_t) p, (uint32_t) (num & (cSegmentBits - 1)));
+              }
+
+              for (bucket_block *block = ring.take(s); block; )
+              {
+                  for (uint64_t e = 0; e < block->cEntries; e++)
+                  {
+                      uint32_t p = block->entries[e].prime;
+                      uint64_t num = block->entries[e].offset;
+                      segment[num >> 6] &= ~(1ULL << (num & 63));
+                      num += p;
+                      ring.push(s + (num >> cSegmentShift), p, (uint32_t) (num & (cSegmentBits - 1)));
+                  }
+                  bucket_block *next = block->next;
+                  ring.release(block);
+                  block = next;
+              }
+
+              phase.switchTo(PHASE_COUNT);
+              found += countBits(segment, 0, segmentBits);
+          }
+          return found;
+      }
+
+   public:
+
+      static size_t defaultSegmentBytes()
+      {
+          return cacheSizeBytes(1);
+      }
+
+      prime_sieve_bucket(uint64_t n, unsigned int threads, size_t segmentBytes = defaultSegmentBytes())
+        : limit(n), cBits(n >> 1), cThreads(std::max(1u, threads))
+      {
+          // A power of two bits, so a bit index splits into segment and offset with a shift and a mask
+          cSegmentShift = 9;
+          while (cSegmentShift < 32 && (1ULL << (cSegmentShift + 1)) <= segmentBytes * 8)
+              cSegmentShift++;
+          cSegmentBits = 1ULL << cSegmentShift;
+      }
+
+      // reset
+      //
+      // Nothing to do: runSieve starts every run of segments from scratch.
+
+      void reset()
+      {
+      }
+
+      // runSieve
+      //
+      // Finds the seed primes, then lets every worker in the pool claim runs of segments off a shared counter.
+      // A single thread takes the whole range as one run; with more there are eight runs per thread, few
+      // enough that restarting the primes for each costs nothing, and enough to even out the load.
+
+      void runSieve(worker_pool &pool)
+      {
+          {
+              profile_phase phase(PHASE_SIEVE);
+              computeSeedPrimes();
+          }
+          count = 0;
+          if (limit <= 2)
+              return;
+
+          uint64_t cSegments = (cBits + cSegmentBits - 1) >> cSegmentShift;
+          uint64_t cRuns = std::min<uint64_t>(cSegments, pool.size() == 1 ? 1 : pool.size() * 8);
+          std::atomic<uint64_t> nextRun(0), total(0);
+          std::atomic<size_t> maxBucketBytes(0);
+          uint64_t maxPrime = seedPrimes.empty() ? 0 : seedPrimes.back();
+
+          pool.run([&](unsigned int)
+          {
+              std::unique_ptr<uint64_t[]> segment(new uint64_t[cSegmentBits >> 6]);
+              bucket_ring ring((maxPrime >> cSegmentShift) + 1);
+              uint64_t found = 0;
+              for (uint64_t r; (r = nextRun.fetch_add(1, std::memory_order_relaxed)) < cRuns; )
+                  found += countSegments(r * cSegments / cRuns, (r + 1) * cSegments / cRuns, segment.get(), ring);
+              total += found;
+
+              size_t bytes = ring.allocatedBytes(), seen = maxBucketBytes.load();
+              while (bytes > seen && !maxBucketBytes.compare_exchange_weak(seen, bytes))
+                  ;
+          });
+          count = total;
+          bucketBytes = maxBucketBytes;
+      }
+
+      void runSieve()
+      {
+          worker_pool pool(cThreads);
+          runSieve(pool);
+      }
+
+      size_t countPrimes() const
+      {
+          return count;
+      }
+
+      uint64_t segmentBytes() const
+      {
+          return cSegmentBits >> 3;
+      }
+
+      bool validateResults() const
+      {
+          return validatePrimeCount(limit, countPrimes());
+      }
+
+      // printResults
+      //
+      // Same report as prime_sieve_segmented::printResults, less the primes themselves, which are gone by the
+      // time a segment has been counted, and with the memory the buckets took.
+
+      void printResults(double duration, size_t passes, size_t threads, double bestPass) const
+      {
+          std::cout << "Passes: "  << passes << ", "
+                    << "Threads: " << threads << ", "
+                    << "Time: "    << duration << ", "
+                    << "Average: " << duration/passes << ", "
+                    << "Best: "    << bestPass << ", "
+                    << "Per second: " << passes/duration << ", "
+                    << "Limit: "   << limit << ", "
+                    << "Segment: " << segmentBytes() << ", "
+                    << "Buckets: " << bucketBytes << ", "
+                    << "Count: "   << count << ", "
+                    << "Valid : "  << (validateResults() ? "Pass" : "FAIL!")
+                    << "\n";
+      }
+};
@@ -0,0 +1,95 @@
+// ---------------------------------------------------------------------------
+// cache_info.h : CPU cache sizes as reported by /sys/devices/system/cpu
+// ---------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#if defined(__linux__)
+#include <unistd.h>
+#endif
+
+struct cpu_cache
+{
+    int level;
+    std::string type;                                           // "Data", "Instruction" or "Unified"
+    size_t size;                                                // In bytes
+};
+
+// parseCacheSize
+//
+// sysfs reports sizes like "48K", "2048K" or "32M".
+
+inline size_t parseCacheSize(const std::string &text)
+{
+    char *end = nullptr;
+    size_t size = strtoull(text.c_str(), &end, 10);
+    if (end && (*end == 'K' || *end == 'k'))
+        size <<= 10;
+    else if (end && (*end == 'M' || *end == 'm'))
+        size <<= 20;
+    else if (end && (*end == 'G' || *end == 'g'))
+        size <<= 30;
+    return size;
+}
+
+// readCpuCaches
+//
+// Walks /sys/devices/system/cpu/cpuN/cache/index0..., stopping at the first index that isn't there.  Returns
+// an empty list where sysfs isn't available.
+
+inline std::vector<cpu_cache> readCpuCaches(int cpu = 0)
+{
+    std::vector<cpu_cache> caches;
+    std::string base = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/cache/index";
+
+    for (int index = 0; ; index++)
+    {
+        std::string dir = base + std::to_string(index) + "/";
+        std::ifstream level(dir + "level"), type(dir + "type"), size(dir + "size");
+        if (!level || !type || !size)
+            break;
+
+        cpu_cache cache;
+        std::string sizeText;
+        level >> cache.level;
+        type >> cache.type;
+        size >> sizeText;
+        cache.size = parseCacheSize(sizeText);
+        caches.push_back(cache);
+    }
+    return caches;
+}
+
+// cacheSizeBytes
+//
+// Size of the data (or unified) cache at the given level, read once from sysfs.  Falls back to sysconf, and
+// failing that to typical values, so callers always get something usable.
+
+inline size_t cacheSizeBytes(int level)
+{
+    static const std::vector<cpu_cache> caches = readCpuCaches();
+
+    for (const auto &cache : caches)
+        if (cache.level == level && cache.type != "Instruction" && cache.size > 0)
+            return cache.size;
+
+    long size = 0;
+#if defined(__linux__) && defined(_SC_LEVEL1_DCACHE_SIZE)
+    if (level == 1)
+        size = sysconf(_SC_LEVEL1_DCACHE_SIZE);
+    else if (level == 2)
+        size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    else if (level == 3)
+        size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+#endif
+    if (size > 0)
+        return (size_t) size;
+
+    return level == 1 ? 32 * 1024 : level == 2 ? 256 * 1024 : 8 * 1024 * 1024;
+}
@@ -0,0 +1,331 @@
+// ---------------------------------------------------------------------------
+// cpu_topology.h : Cores, SMT siblings, L3 domains and NUMA nodes as reported by /sys/devices/system
+// ---------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#if defined(__linux__)
+#include <dirent.h>
+#include <sched.h>
+#endif
+
+#if defined(__linux__)
+const unsigned long CPU_LIST_LIMIT = CPU_SETSIZE;
+#else
+const unsigned long CPU_LIST_LIMIT = 1024;
+#endif
+
+// parseCpuList
+//
+// sysfs (and our --affinity option) write CPU sets as lists of numbers and ranges: "0-3,8,10-11".  Returns
+// false on anything else, including a CPU number that no cpu_set_t could hold.
+
+inline bool parseCpuList(const std::string &text, std::vector<unsigned int> &cpus)
+{
+    std::istringstream in(text);
+    std::string item;
+    while (std::getline(in, item, ','))
+    {
+        if (item.empty() || item == "\n")
+            continue;
+        char *end = nullptr;
+        unsigned long first = strtoul(item.c_str(), &end, 10), last = first;
+        if (end == item.c_str())
+            return false;
+        if (*end == '-')
+        {
+            const char *start = end + 1;
+            last = strtoul(start, &end, 10);
+            if (end == start || last < first)
+                return false;
+        }
+        if ((*end != '\0' && *end != '\n') || last >= CPU_LIST_LIMIT)
+            return false;
+        for (unsigned long cpu = first; cpu <= last; cpu++)
+            cpus.push_back((unsigned int) cpu);
+    }
+    return !cpus.empty();
+}
+
+inline std::string formatCpuList(const std::vector<unsigned int> &cpus)
+{
+    std::string text;
+    for (auto cpu : cpus)
+        text += (text.empty() ? "" : ",") + std::to_string(cpu);
+    return text;
+}
+
+// cpu_topology
+//
+// Where every CPU we may run on sits: its package and core (SMT siblings share both), which L3 it shares and
+// which NUMA node it belongs to.  smtIndex is the CPU's position among its core's siblings, so 0 marks the
+// first hardware thread of every physical core.  Without sysfs every CPU is treated as a core of its own.
+
+struct cpu_topology
+{
+    struct cpu
+    {
+        unsigned int id;
+        int package = 0;
+        int core = 0;
+        int l3 = 0;
+        int node = 0;
+        unsigned int smtIndex = 0;
+    };
+
+    std::vector<cpu> cpus;
+
+    static std::string readLine(const std::string &path)
+    {
+        std::ifstream in(path);
+        std::string line;
+        std::getline(in, line);
+        return line;
+    }
+
+    static cpu_topology read(const std::string &root = "/sys/devices/system")
+    {
+        cpu_topology topology;
+
+        std::vector<unsigned int> online;
+        if (!parseCpuList(readLine(root + "/cpu/online"), online))
+            for (unsigned int i = 0; i < std::max(1u, std::thread::hardware_concurrency()); i++)
+                online.push_back(i);
+
+#if defined(__linux__)
+        // Leave out CPUs we aren't allowed on (taskset, cgroup cpusets)
+        cpu_set_t allowed;
+        if (root == "/sys/devices/system" && sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+            online.erase(std::remove_if(online.begin(), online.end(),
+                                        [&](unsigned int id) { return id >= CPU_SETSIZE || !CPU_ISSET(id, &allowed); }),
+                         online.end());
+#endif
+
+        std::map<unsigned int, int> nodeOf;
+#if defined(__linux__)
+        if (DIR *dir = opendir((root + "/node").c_str()))
+        {
+            while (dirent *entry = readdir(dir))
+            {
+                std::string name = entry->d_name;
+                if (name.compare(0, 4, "node") != 0 || name.size() == 4 || !isdigit((unsigned char) name[4]))
+                    continue;
+                std::vector<unsigned int> nodeCpus;
+                parseCpuList(readLine(root + "/node/" + name + "/cpulist"), nodeCpus);
+                for (auto id : nodeCpus)
+                    nodeOf[id] = atoi(name.c_str() + 4);
+            }
+            closedir(dir);
+        }
+#endif
+
+        for (auto id : online)
+        {
+            cpu_topology::cpu c;
+            c.id = id;
+            std::string base = root + "/cpu/cpu" + std::to_string(id);
+
+            std::string package = readLine(base + "/topology/physical_package_id");
+            std::string core = readLine(base + "/topology/core_id");
+            c.package = package.empty() ? 0 : atoi(package.c_str());
+            c.core    = core.empty() ? (int) id : atoi(core.c_str());
+            c.node    = nodeOf.count(id) ? nodeOf[id] : 0;
+
+            std::vector<unsigned int> siblings;
+            if (parseCpuList(readLine(base + "/topology/thread_siblings_list"), siblings))
+                c.smtIndex = (unsigned int) (std::find(siblings.begin(), siblings.end(), id) - siblings.begin());
+
+            // The L3 is identified by the lowest CPU sharing it, which is unique even where there is no "id"
+            for (int index = 0; ; index++)
+            {
+                std::string dir = base + "/cache/index" + std::to_string(index);
+                std::string level = readLine(dir + "/level");
+                if (level.empty())
+                    break;
+                std::vector<unsigned int> sharing;
+                if (level == "3" && parseCpuList(readLine(dir + "/shared_cpu_list"), sharing))
+                    c.l3 = (int) *std::min_element(sharing.begin(), sharing.end());
+            }
+            topology.cpus.push_back(c);
+        }
+        return topology;
+    }
+
+    static const cpu_topology &get()
+    {
+        static const cpu_topology topology = read();
+        return topology;
+    }
+
+    template <typename Key>
+    size_t countDistinct(Key key) const
+    {
+        std::vector<decltype(key(cpus[0]))> keys;
+        for (const auto &c : cpus)
+            keys.push_back(key(c));
+        std::sort(keys.begin(), keys.end());
+        return std::unique(keys.begin(), keys.end()) - keys.begin();
+    }
+
+    size_t physicalCores() const { return countDistinct([](const cpu &c) { return std::make_pair(c.package, c.core); }); }
+    size_t l3Domains() const     { return countDistinct([](const cpu &c) { return c.l3; }); }
+    size_t numaNodes() const     { return countDistinct([](const cpu &c) { return c.node; }); }
+
+    std::string summary() const
+    {
+        std::ostringstream out;
+        out << cpus.size() << " CPU" << (cpus.size() == 1 ? "" : "s") << ", " << physicalCores() << " core"
+            << (physicalCores() == 1 ? "" : "s") << ", " << l3Domains() << " L3 domain"
+            << (l3Domains() == 1 ? "" : "s") << ", " << numaNodes() << " NUMA node" << (numaNodes() == 1 ? "" : "s");
+        return out.str();
+    }
+
+    // compactOrder
+    //
+    // Fills one core's SMT siblings, then the next core sharing the same L3, then the next L3 in the same node.
+
+    std::vector<unsigned int> compactOrder() const
+    {
+        std::vector<cpu> sorted = cpus;
+        std::sort(sorted.begin(), sorted.end(), [](const cpu &a, const cpu &b)
+        {
+            return std::make_tuple(a.node, a.l3, a.package, a.core, a.smtIndex, a.id)
+                 < std::make_tuple(b.node, b.l3, b.package, b.core, b.smtIndex, b.id);
+        });
+        std::vector<unsigned int> order;
+        for (const auto &c : sorted)
+            order.push_back(c.id);
+        return order;
+    }
+
+    // physicalOrder
+    //
+    // The first hardware thread of every core, in compact order, and only then their SMT siblings.
+
+    std::vector<unsigned int> physicalOrder() const
+    {
+        std::vector<cpu> sorted = cpus;
+        std::sort(sorted.begin(), sorted.end(), [](const cpu &a, const cpu &b)
+        {
+            return std::make_tuple(a.smtIndex, a.node, a.l3, a.package, a.core, a.id)
+                 < std::make_tuple(b.smtIndex, b.node, b.l3, b.package, b.core, b.id);
+        });
+        std::vector<unsigned int> order;
+        for (const auto &c : sorted)
+            order.push_back(c.id);
+        return order;
+    }
+
+    // scatterOrder
+    //
+    // Round-robin over the L3 domains, alternating NUMA nodes, taking physical cores before SMT siblings
+    // within each domain, so that every added thread gets as much cache and memory bandwidth to itself as
+    // possible.
+
+    std::vector<unsigned int> scatterOrder() const
+    {
+        std::map<std::pair<int, int>, std::vector<unsigned int>> domains;     // (node, l3) -> CPUs
+        for (auto id : physicalOrder())
+            for (const auto &c : cpus)
+                if (c.id == id)
+                    domains[{ c.node, c.l3 }].push_back(id);
+
+        // Order the domains by their rank within their node, then by node, so consecutive ones differ in node
+        std::map<int, int> seenInNode;
+        std::vector<std::tuple<int, int, const std::vector<unsigned int> *>> ranked;
+        for (const auto &domain : domains)
+            ranked.emplace_back(seenInNode[domain.first.first]++, domain.first.first, &domain.second);
+        std::sort(ranked.begin(), ranked.end());
+
+        std::vector<unsigned int> order;
+        for (size_t i = 0; order.size() < cpus.size(); i++)
+            for (const auto &domain : ranked)
+                if (i < std::get<2>(domain)->size())
+                    order.push_back((*std::get<2>(domain))[i]);
+        return order;
+    }
+};
+
+enum class affinity_policy { none, compact, scatter, physical, list };
+
+// cpu_affinity
+//
+// How worker_pool places its threads: left to the OS scheduler, pinned along one of the topology orders
+// above, or pinned to an explicit list of CPUs.  Thread i goes to the i-th CPU of the order, wrapping around
+// when there are more threads than CPUs.
+
+struct cpu_affinity
+{
+    affinity_policy policy = affinity_policy::none;
+    std::vector<unsigned int> cpus;                             // For affinity_policy::list
+
+    std::vector<unsigned int> order(const cpu_topology &topology = cpu_topology::get()) const
+    {
+        switch (policy)
+        {
+            case affinity_policy::none:     return {};
+            case affinity_policy::compact:  return topology.compactOrder();
+            case affinity_policy::scatter:  return topology.scatterOrder();
+            case affinity_policy::physical: return topology.physicalOrder();
+            case affinity_policy::list:     return cpus;
+        }
+        return {};
+    }
+};
+
+inline cpu_affinity &defaultAffinity()
+{
+    static cpu_affinity affinity;
+    return affinity;
+}
+
+inline std::string affinityName(const cpu_affinity &affinity)
+{
+    switch (affinity.policy)
+    {
+        case affinity_policy::none:     return "none";
+        case affinity_policy::compact:  return "compact";
+        case affinity_policy::scatter:  return "scatter";
+        case affinity_policy::physical: return "physical";
+        case affinity_policy::list:     return formatCpuList(affinity.cpus);
+    }
+    return "none";
+}
+
+inline bool parseAffinity(const std::string &name, cpu_affinity &affinity)
+{
+    cpu_affinity parsed;
+    if (name == "none")
+        parsed.policy = affinity_policy::none;
+    else if (name == "compact")
+        parsed.policy = affinity_policy::compact;
+    else if (name == "scatter")
+        parsed.policy = affinity_policy::scatter;
+    else if (name == "physical")
+        parsed.policy = affinity_policy::physical;
+    else if (parseCpuList(name, parsed.cpus))
+    {
+        // Only CPUs that are online here
+        unsigned int highest = 0;
+        for (auto &cpu : cpu_topology::get().cpus)
+            highest = std::max(highest, cpu.id);
+        if (*std::max_element(parsed.cpus.begin(), parsed.cpus.end()) > highest)
+            return false;
+        parsed.policy = affinity_policy::list;
+    }
+    else
+        return false;
+    affinity = parsed;
+    return true;
+}
@@ -0,0 +1,696 @@
+// ---------------------------------------------------------------------------
+// distributed_sieve.h : Coordinator and worker processes sieving segments over TCP or Unix sockets
+// ---------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "prime_writer.h"
+#include "range_sieve.h"
+#include "worker_pool.h"
+
+// The protocol is lines of text, one message per line, so it can be watched with tcpdump or driven by hand
+// with nc:
+//
+//     worker -> coordinator   HELLO <threads>
+//     coordinator -> worker   SIEVE <id> <lo> <hi> count|bitmap
+//                             BYE
+//     worker -> coordinator   COUNT <id> <count> <seconds>
+//                             BITMAP <id> <count> <seconds> <bytes>, followed by that many bytes
+//
+// A bitmap is the primes of [lo, hi) as the gaps between their bits in the odd-only layout (2 taking bit 0,
+// as 1 is never prime), each a LEB128 varint from the bit of lo.  Prime gaps are small, so that is a byte a
+// prime against the 1/density bits of the bitmap itself: about half the size at 1e13.
+//
+// The sockets are Linux-only, as are the worker processes runCoordinator spawns; elsewhere only the bitmap
+// encoding is compiled, and --coordinator and --worker report that they are unsupported.
+
+#if defined(__linux__)
+
+// socket_address
+//
+// "unix:/path" for a Unix socket, "host:port" or "tcp:host:port" for TCP.
+
+struct socket_address
+{
+    bool bUnix = false;
+    std::string path;
+    std::string host;
+    std::string port;
+
+    bool parse(const std::string &text)
+    {
+        std::string rest = text;
+        if (rest.compare(0, 5, "unix:") == 0)
+        {
+            bUnix = true;
+            path = rest.substr(5);
+            return !path.empty() && path.size() < sizeof(sockaddr_un::sun_path);
+        }
+        if (rest.compare(0, 4, "tcp:") == 0)
+            rest = rest.substr(4);
+        size_t colon = rest.rfind(':');
+        if (colon == std::string::npos || colon + 1 == rest.size())
+            return false;
+        host = rest.substr(0, colon);
+        port = rest.substr(colon + 1);
+        return true;
+    }
+
+    std::string describe() const
+    {
+        return bUnix ? "unix:" + path : host + ":" + port;
+    }
+};
+
+// openSocket
+//
+// A listening or a connected socket for the address, or -1 with the reason in 'error'.
+
+inline int openSocket(const socket_address &address, bool bListen, std::string &error)
+{
+    if (address.bUnix)
+    {
+        sockaddr_un sa = {};
+        sa.sun_family = AF_UNIX;
+        strncpy(sa.sun_path, address.path.c_str(), sizeof(sa.sun_path) - 1);
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+        {
+            error = strerror(errno);
+            return -1;
+        }
+        if (bListen)
+            unlink(address.path.c_str());
+        int rc = bListen ? bind(fd, (sockaddr *) &sa, sizeof(sa)) : connect(fd, (sockaddr *) &sa, sizeof(sa));
+        if (rc != 0 || (bListen && listen(fd, 64) != 0))
+        {
+            error = strerror(errno);
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    addrinfo hints = {}, *found = nullptr;
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags    = bListen ? AI_PASSIVE : 0;
+    int rc = getaddrinfo(address.host.empty() ? nullptr : address.host.c_str(), address.port.c_str(), &hints, &found);
+    if (rc != 0)
+    {
+        error = gai_strerror(rc);
+        return -1;
+    }
+
+    int fd = -1;
+    error = "no usable address";
+    for (addrinfo *ai = found; ai && fd < 0; ai = ai->ai_next)
+    {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0)
+            continue;
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (bListen)
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        rc = bListen ? bind(fd, ai->ai_addr, ai->ai_addrlen) : connect(fd, ai->ai_addr, ai->ai_addrlen);
+        if (rc != 0 || (bListen && listen(fd, 64) != 0))
+        {
+            error = strerror(errno);
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(found);
+    return fd;
+}
+
+// Never raises SIGPIPE: a peer that has gone away is an error return like any other
+inline bool sendAll(int fd, const char *p, size_t left)
+{
+    while (left)
+    {
+        ssize_t n = send(fd, p, left, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        left -= n;
+    }
+    return true;
+}
+
+inline bool sendAll(int fd, const std::string &text)
+{
+    return sendAll(fd, text.data(), text.size());
+}
+
+// socket_reader
+//
+// What has come in on a socket and not yet been taken as messages.  fill() is one recv(), so the
+// coordinator can call it when poll() says there is something and never block.
+
+class socket_reader
+{
+  protected:
+
+      std::string buffer;
+      size_t used = 0;                                          // Bytes at the front already taken
+
+   public:
+
+      int fd = -1;
+
+      // >0 bytes read, 0 at end of stream, -1 on error
+      int fill()
+      {
+          if (used > 0)
+          {
+              buffer.erase(0, used);
+              used = 0;
+          }
+          char chunk[65536];
+          ssize_t n;
+          while ((n = recv(fd, chunk, sizeof(chunk), 0)) < 0 && errno == EINTR)
+              ;
+          if (n > 0)
+              buffer.append(chunk, n);
+          return n > 0 ? 1 : (int) n;
+      }
+
+      // The next whole line, without its newline, or false if it hasn't all come in yet.  Nothing is taken:
+      // a line announcing a payload is left until the payload has come in as well.
+      bool peekLine(std::string &line, size_t &lineBytes) const
+      {
+          size_t end = buffer.find('\n', used);
+          if (end == std::string::npos)
+              return false;
+          line = buffer.substr(used, end - used);
+          lineBytes = end + 1 - used;
+          return true;
+      }
+
+      size_t available() const
+      {
+          return buffer.size() - used;
+      }
+
+      std::string take(size_t n)
+      {
+          std::string taken = buffer.substr(used, n);
+          used += n;
+          return taken;
+      }
+
+      // Blocking read of a line, for the worker
+      bool readLine(std::string &line)
+      {
+          size_t lineBytes;
+          while (!peekLine(line, lineBytes))
+              if (fill() <= 0)
+                  return false;
+          take(lineBytes);
+          return true;
+      }
+};
+
+#endif
+
+inline void appendVarint(std::string &out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out += (char) (value | 0x80);
+        value >>= 7;
+    }
+    out += (char) value;
+}
+
+inline bool readVarint(const std::string &in, size_t &pos, uint64_t &value)
+{
+    value = 0;
+    for (int shift = 0; pos < in.size() && shift < 64; shift += 7)
+    {
+        uint8_t byte = (uint8_t) in[pos++];
+        value |= (uint64_t) (byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+// The bit a prime has in the encoding
+inline uint64_t primeBit(uint64_t prime)
+{
+    return prime == 2 ? 0 : prime >> 1;
+}
+
+// decodePrimes
+//
+// Calls fn with every prime of an encoded bitmap for [lo, hi); false if it doesn't decode to 'count' primes
+// inside the window.
+
+template <typename F>
+bool decodePrimes(const std::string &encoded, uint64_t lo, uint64_t hi, uint64_t count, F fn)
+{
+    uint64_t bit = lo >> 1, gap, found = 0;
+    for (size_t pos = 0; pos < encoded.size(); found++)
+    {
+        if (!readVarint(encoded, pos, gap))
+            return false;
+        bit += gap;
+        uint64_t prime = bit ? (bit << 1) + 1 : 2;
+        if (prime < lo || prime >= hi)
+            return false;
+        fn(prime);
+    }
+    return found == count;
+}
+
+#if defined(__linux__)
+
+// sieve_worker
+//
+// Connects to the coordinator, says how many threads it has, and then sieves whatever segments it is sent,
+// one at a time with range_sieve on its own worker pool, until it is told BYE or the coordinator goes away.
+
+class sieve_worker
+{
+  protected:
+
+      socket_reader reader;
+      unsigned int cThreads;
+      size_t segmentBytes;
+
+   public:
+
+      uint64_t cSegments = 0;
+      double busySeconds = 0;
+
+      sieve_worker(unsigned int threads, size_t segmentBytesPerWindow)
+        : cThreads(std::max(1u, threads)), segmentBytes(segmentBytesPerWindow)
+      {
+      }
+
+      ~sieve_worker()
+      {
+          if (reader.fd >= 0)
+              close(reader.fd);
+      }
+
+      // connect
+      //
+      // Keeps trying for cSecondsToRetry, so workers can be started before the coordinator is listening.
+
+      bool connect(const socket_address &address, double cSecondsToRetry, std::string &error)
+      {
+          auto tGiveUp = std::chrono::steady_clock::now() + std::chrono::duration<double>(cSecondsToRetry);
+          while ((reader.fd = openSocket(address, false, error)) < 0 && std::chrono::steady_clock::now() < tGiveUp)
+              std::this_thread::sleep_for(std::chrono::milliseconds(100));
+          return reader.fd >= 0;
+      }
+
+      // run
+      //
+      // Returns true when the coordinator said BYE, false if the connection failed or it sent nonsense.
+
+      bool run(std::string &error)
+      {
+          if (!sendAll(reader.fd, "HELLO " + std::to_string(cThreads) + "\n"))
+          {
+              error = strerror(errno);
+              return false;
+          }
+
+          worker_pool pool(cThreads);
+          std::string line;
+          while (reader.readLine(line))
+          {
+              std::istringstream in(line);
+              std::string command, mode;
+              uint64_t id, lo, hi;
+              in >> command;
+              if (command == "BYE")
+                  return true;
+              if (command != "SIEVE" || !(in >> id >> lo >> hi >> mode) || lo > hi)
+              {
+                  error = "unexpected message: " + line;
+                  return false;
+              }
+
+              auto tStart = std::chrono::steady_clock::now();
+              range_sieve sieve(lo, hi, cThreads, segmentBytes);
+              sieve.runSieve(pool);
+              uint64_t count = sieve.countPrimes();
+              std::string payload;
+              if (mode == "bitmap")
+              {
+                  uint64_t bit = lo >> 1;
+                  sieve.forEachPrime([&](uint64_t prime)
+                  {
+                      appendVarint(payload, primeBit(prime) - bit);
+                      bit = primeBit(prime);
+                  });
+              }
+              double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+              busySeconds += seconds;
+              cSegments++;
+
+              std::string reply = (mode == "bitmap" ? "BITMAP " : "COUNT ") + std::to_string(id) + " "
+                                + std::to_string(count) + " " + std::to_string(seconds);
+              if (mode == "bitmap")
+                  reply += " " + std::to_string(payload.size());
+              if (!sendAll(reader.fd, reply + "\n" + payload))
+              {
+                  error = strerror(errno);
+                  return false;
+              }
+          }
+          error = "the coordinator closed the connection";
+          return false;
+      }
+};
+
+// distributed_segment / worker_connection
+//
+// The coordinator's view of one segment, and of one worker: what it has been sent and not yet answered,
+// and what it has done.
+
+struct distributed_segment
+{
+    uint64_t lo;
+    uint64_t hi;
+    bool bDone = false;
+    unsigned int cAssigned = 0;                                 // More than once if it was reassigned
+};
+
+struct worker_connection
+{
+    socket_reader reader;
+    std::string name;                                           // "worker 3", in the order they connected
+    std::deque<uint64_t> outstanding;
+    unsigned int cThreads = 0;
+    uint64_t cSegments = 0;
+    double busySeconds = 0;
+    std::chrono::steady_clock::time_point tLastHeard;
+    bool bLost = false;
+};
+
+const unsigned int SEGMENTS_PER_WORKER = 2;
+const uint64_t BITMAP_SEGMENTS_AHEAD = 16;                     // Under a GB of held bitmaps at the default chunk
+
+// sieve_coordinator
+//
+// Splits [lo, hi) into segments of 'chunk' numbers and hands them to whichever workers connect, two at a
+// time each so a worker has its next segment queued while its last result is on the way back.  A worker
+// whose connection drops, or with work out that it hasn't answered for workerTimeout seconds, is dropped
+// and its segments go back to the front of the queue for the others.  A segment is only ever counted once,
+// whoever finishes it.
+//
+// Counts are summed in any order.  Bitmaps are written with prime_writer, so they have to come out in
+// order: each one is held until all those before it are in.  So that a slow worker can't leave every later
+// bitmap piling up behind it, no segment more than BITMAP_SEGMENTS_AHEAD past the next one to be written is
+// handed out; the others wait for it instead.
+
+class sieve_coordinator
+{
+  protected:
+
+      std::vector<distributed_segment> segments;
+      std::deque<uint64_t> pending;
+      std::vector<std::unique_ptr<worker_connection>> workers;
+      uint64_t lo, hi;
+      bool bBitmaps;
+      std::map<uint64_t, std::string> heldBitmaps;              // Arrived ahead of their turn
+      uint64_t nextToWrite = 0;
+      std::unique_ptr<prime_writer> writer;
+      uint64_t cDone = 0;
+
+      void drop(worker_connection &worker, const char *reason)
+      {
+          if (worker.bLost)
+              return;
+          fprintf(stderr, "Lost %s (%s), reassigning %zu segment%s\n", worker.name.c_str(), reason,
+              worker.outstanding.size(), worker.outstanding.size() == 1 ? "" : "s");
+          close(worker.reader.fd);
+          worker.bLost = true;
+          cReassigned += worker.outstanding.size();
+          for (auto id = worker.outstanding.rbegin(); id != worker.outstanding.rend(); ++id)
+              pending.push_front(*id);
+          worker.outstanding.clear();
+      }
+
+      bool assign(worker_connection &worker)
+      {
+          while (worker.outstanding.size() < SEGMENTS_PER_WORKER && !pending.empty())
+          {
+              uint64_t id = pending.front();
+              if (bBitmaps && id >= nextToWrite + BITMAP_SEGMENTS_AHEAD)
+                  break;
+              distributed_segment &segment = segments[id];
+              std::string message = "SIEVE " + std::to_string(id) + " " + std::to_string(segment.lo) + " "
+                                  + std::to_string(segment.hi) + (bBitmaps ? " bitmap\n" : " count\n");
+              if (!sendAll(worker.reader.fd, message))
+                  return false;
+              pending.pop_front();
+              segment.cAssigned++;
+              worker.outstanding.push_back(id);
+              if (worker.outstanding.size() == 1)
+                  worker.tLastHeard = std::chrono::steady_clock::now();
+          }
+          return true;
+      }
+
+      void writeHeldBitmaps()
+      {
+          for (auto next = heldBitmaps.begin(); next != heldBitmaps.end() && next->first == nextToWrite; next = heldBitmaps.begin())
+          {
+              const distributed_segment &segment = segments[next->first];
+              decodePrimes(next->second, segment.lo, segment.hi, UINT64_MAX, [&](uint64_t prime) { writer->put(prime); });
+              heldBitmaps.erase(next);
+              nextToWrite++;
+          }
+      }
+
+      // complete
+      //
+      // A result from a worker; false if it isn't one the worker was waiting on, or its bitmap is damaged.
+
+      bool complete(worker_connection &worker, uint64_t id, uint64_t found, double seconds, std::string *payload)
+      {
+          auto it = std::find(worker.outstanding.begin(), worker.outstanding.end(), id);
+          if (it == worker.outstanding.end())
+              return false;
+          distributed_segment &segment = segments[id];
+          if (payload && !decodePrimes(*payload, segment.lo, segment.hi, found, [](uint64_t) {}))
+              return false;
+
+          worker.outstanding.erase(it);
+          worker.cSegments++;
+          worker.busySeconds += seconds;
+          if (segment.bDone)
+              return true;
+          segment.bDone = true;
+          count += found;
+          cDone++;
+          if (payload)
+          {
+              heldBitmaps[id] = std::move(*payload);
+              writeHeldBitmaps();
+          }
+          return true;
+      }
+
+      // Takes every whole message the worker has sent; false on anything it shouldn't have sent
+      bool readMessages(worker_connection &worker)
+      {
+          std::string line;
+          size_t lineBytes;
+          while (worker.reader.peekLine(line, lineBytes))
+          {
+              std::istringstream in(line);
+              std::string command;
+              uint64_t id, found, cBytes = 0;
+              double seconds;
+              in >> command;
+              if (command == "HELLO")
+              {
+                  if (!(in >> worker.cThreads))
+                      return false;
+                  worker.reader.take(lineBytes);
+              }
+              else if (command == "COUNT")
+              {
+                  if (!(in >> id >> found >> seconds))
+                      return false;
+                  worker.reader.take(lineBytes);
+                  if (!complete(worker, id, found, seconds, nullptr))
+                      return false;
+              }
+              else if (command == "BITMAP")
+              {
+                  if (!(in >> id >> found >> seconds >> cBytes))
+                      return false;
+                  if (worker.reader.available() < lineBytes + cBytes)
+                      break;
+                  worker.reader.take(lineBytes);
+                  std::string payload = worker.reader.take(cBytes);
+                  if (!complete(worker, id, found, seconds, &payload))
+                      return false;
+              }
+              else
+                  return false;
+              worker.tLastHeard = std::chrono::steady_clock::now();
+          }
+          return true;
+      }
+
+   public:
+
+      uint64_t count = 0;
+      uint64_t cReassigned = 0;
+
+      sieve_coordinator(uint64_t from, uint64_t to, uint64_t chunk, bool bWriteBitmaps)
+        : lo(from), hi(std::max(from, to)), bBitmaps(bWriteBitmaps)
+      {
+          chunk = std::max<uint64_t>(chunk, 128);
+          for (uint64_t start = lo; start < hi; start += std::min(chunk, hi - start))
+          {
+              distributed_segment segment;
+              segment.lo = start;
+              segment.hi = start + std::min(chunk, hi - start);
+              pending.push_back(segments.size());
+              segments.push_back(segment);
+          }
+      }
+
+      size_t segmentCount() const
+      {
+          return segments.size();
+      }
+
+      const std::vector<std::unique_ptr<worker_connection>> &connections() const
+      {
+          return workers;
+      }
+
+      // run
+      //
+      // Serves workers on listenFd until every segment is done.  bGiveUp is asked once a second while no
+      // worker is connected, and returning true from it abandons the run; run() then returns false, as it
+      // does for a window whose primes the output format can't hold, with the reason in 'error'.
+
+      bool run(int listenFd, double workerTimeout, std::function<bool()> bGiveUp, std::string &error)
+      {
+          if (bBitmaps)
+          {
+              if (!prime_output::get().holds(hi))
+              {
+                  error = "--format u32 only holds primes below 2^32";
+                  return false;
+              }
+              writer.reset(new prime_writer());
+          }
+
+          while (cDone < segments.size())
+          {
+              std::vector<pollfd> fds = { { listenFd, POLLIN, 0 } };
+              std::vector<worker_connection *> polled;
+              for (auto &worker : workers)
+              {
+                  if (worker->bLost)
+                      continue;
+                  fds.push_back({ worker->reader.fd, POLLIN, 0 });
+                  polled.push_back(worker.get());
+              }
+              if (poll(fds.data(), fds.size(), 1000) < 0 && errno != EINTR)
+              {
+                  error = strerror(errno);
+                  return false;
+              }
+
+              if (fds[0].revents & POLLIN)
+              {
+                  int fd = accept(listenFd, nullptr, nullptr);
+                  if (fd >= 0)
+                  {
+                      std::unique_ptr<worker_connection> worker(new worker_connection);
+                      worker->reader.fd = fd;
+                      worker->name = "worker " + std::to_string(workers.size() + 1);
+                      worker->tLastHeard = std::chrono::steady_clock::now();
+                      workers.push_back(std::move(worker));
+                  }
+              }
+
+              for (size_t w = 0; w < polled.size(); w++)
+              {
+                  worker_connection &worker = *polled[w];
+                  if (!fds[w + 1].revents)
+                      continue;
+                  int rc = worker.reader.fill();
+                  if (rc <= 0)
+                      drop(worker, rc == 0 ? "disconnected" : strerror(errno));
+                  else if (!readMessages(worker))
+                      drop(worker, "protocol error");
+              }
+
+              auto now = std::chrono::steady_clock::now();
+              bool bAnyWorkers = false;
+              for (auto &worker : workers)
+              {
+                  if (worker->bLost)
+                      continue;
+                  if (workerTimeout > 0 && !worker->outstanding.empty()
+                      && std::chrono::duration<double>(now - worker->tLastHeard).count() > workerTimeout)
+                      drop(*worker, "timed out");
+                  else if (worker->cThreads && !assign(*worker))
+                      drop(*worker, strerror(errno));
+                  bAnyWorkers = bAnyWorkers || !worker->bLost;
+              }
+              if (!bAnyWorkers && bGiveUp())
+              {
+                  error = "No workers left";
+                  return false;
+              }
+          }
+
+          for (auto &worker : workers)
+          {
+              if (worker->bLost)
+                  continue;
+              sendAll(worker->reader.fd, "BYE\n");
+              close(worker->reader.fd);
+          }
+          writer.reset();
+          return true;
+      }
+};
+
+#endif
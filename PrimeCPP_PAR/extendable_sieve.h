@@ -0,0 +1,183 @@
+// ---------------------------------------------------------------------------
+// extendable_sieve.h : Word sieve whose limit can be raised without sieving the old part again
+// ---------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#include "bitmap_kernels.h"
+#include "bitmap_view.h"
+#include "page_buffer.h"
+#include "popcount.h"
+#include "presieve.h"
+#include "prime_writer.h"
+#include "sieve_common.h"
+
+// prime_sieve_extendable
+//
+// The prime_sieve_words layout, plus what it takes to carry on where the last sieve stopped: every sieving
+// prime found so far and the bit index of its next multiple past the sieved part.  extend() grows the
+// bitmap, fills the new tail from the presieve tile, runs the known primes on from their saved offsets and
+// then picks up the primes that the larger sqrt brings in.  Only the tail is touched; the old bits are never
+// sieved again.
+//
+// The bitmap is always sieved to a whole number of words, a little past the limit, so a later extension
+// starts on a word boundary; the counts and lookups stop at the limit.  Growth is geometric, as with any
+// vector, so a run of small extensions does not copy the bitmap each time.
+
+class prime_sieve_extendable
+{
+  protected:
+
+      std::vector<uint64_t, page_allocator<uint64_t>> Words;   // Bit i is 2i+1, bit 0 standing in for 2
+      std::vector<uint32_t> sievingPrimes;                      // Odd primes past the presieve, p*p inside the sieved part
+      std::vector<uint64_t> nextMultiple;                       // Bit index of each one's first multiple not yet crossed off
+      uint64_t nextCandidate = 0;                               // First bit not yet examined as a sieving prime
+      uint64_t sievedWords = 0;
+      uint64_t limit;
+      uint64_t cBits;
+
+      // sieveTail
+      //
+      // Sieves words [sievedWords, lastWord): the known primes from their saved offsets first, then any new
+      // prime whose square lands in the tail, in increasing order.  As in runSieve of the other engines, by
+      // the time a candidate's bit is read every smaller prime has crossed off its multiples up to lastWord,
+      // so the bit is final whether it lies in the old part or in the tail itself.
+
+      void sieveTail(uint64_t lastWord)
+      {
+          uint64_t firstWord = sievedWords;
+          uint64_t lastBit = lastWord << 6;
+          if (Words.capacity() < lastWord)
+              Words.reserve(std::max<uint64_t>(lastWord, Words.capacity() * 2));
+          Words.resize(lastWord);
+          presieve_pattern::get().fill(&Words[0], firstWord, lastWord);
+
+          for (size_t i = 0; i < sievingPrimes.size(); i++)
+          {
+              uint64_t p = sievingPrimes[i];
+              if (nextMultiple[i] >= lastBit)
+                  continue;
+              crossOff(&Words[0], p, nextMultiple[i], lastBit);
+              nextMultiple[i] += (lastBit - nextMultiple[i] + p - 1) / p * p;
+          }
+
+          uint64_t factor = std::max(nextCandidate, presieve_pattern::get().firstSievingBit());
+          for (; 2 * factor * (factor + 1) < lastBit; factor++)
+          {
+              if (!((Words[factor >> 6] >> (factor & 63)) & 1))
+                  continue;
+              uint64_t p = (factor << 1) + 1, first = 2 * factor * (factor + 1);
+              crossOff(&Words[0], p, first, lastBit);
+              sievingPrimes.push_back((uint32_t) p);
+              nextMultiple.push_back(first + (lastBit - first + p - 1) / p * p);
+          }
+          nextCandidate = factor;
+          sievedWords = lastWord;
+      }
+
+   public:
+
+      prime_sieve_extendable(uint64_t n) : limit(n), cBits(n >> 1)
+      {
+      }
+
+      // reset
+      //
+      // Forgets everything sieved, keeping the buffer.
+
+      void reset()
+      {
+          Words.clear();
+          sievingPrimes.clear();
+          nextMultiple.clear();
+          nextCandidate = 0;
+          sievedWords = 0;
+      }
+
+      // extend
+      //
+      // Raises the limit to newLimit and sieves only the words that adds.
+
+      void extend(uint64_t newLimit)
+      {
+          limit = std::max(limit, newLimit);
+          cBits = limit >> 1;
+          uint64_t cWords = std::max<uint64_t>((cBits + 63) >> 6, 1);
+          if (cWords > sievedWords)
+              sieveTail(cWords);
+      }
+
+      void runSieve()
+      {
+          reset();
+          extend(limit);
+      }
+
+      size_t countPrimes() const
+      {
+          if (limit <= 2)
+              return 0;
+          return countBits(&Words[0], 0, cBits);
+      }
+
+      bool isPrime(uint64_t n) const
+      {
+          if (n == 2)
+              return limit > 2;
+          if (!(n & 1) || n == 1 || n >= limit)
+              return false;
+          return (Words[n >> 7] >> ((n >> 1) & 63)) & 1;
+      }
+
+      bitmap_view view() const
+      {
+          bitmap_view bitmap;
+          bitmap.words = &Words[0];
+          bitmap.limit = limit;
+          bitmap.cBits = cBits;
+          return bitmap;
+      }
+
+      uint64_t sievingPrimeCount() const
+      {
+          return sievingPrimes.size();
+      }
+
+      bool validateResults() const
+      {
+          return validatePrimeCount(limit, countPrimes());
+      }
+
+      // printResults
+      //
+      // Displays stats about what was found as well as (optionally) the primes themselves
+
+      void printResults(bool showResults, double duration, size_t passes, size_t threads) const
+      {
+          size_t count = countPrimes();
+
+          if (showResults)
+          {
+              prime_writer writer;
+              if (limit > 2)
+                  writer.put(2);
+              writer.putOddBits(&Words[0], 1, cBits);
+              writer.finish();
+          }
+
+          std::cout << "Passes: "  << passes << ", "
+                    << "Threads: " << threads << ", "
+                    << "Time: "    << duration << ", "
+                    << "Average: " << duration/passes << ", "
+                    << "Per second: " << passes/duration << ", "
+                    << "Limit: "   << limit << ", "
+                    << "Count: "   << count << ", "
+                    << "Valid : "  << (validatePrimeCount(limit, count) ? "Pass" : "FAIL!")
+                    << "\n";
+      }
+};
@@ -0,0 +1,245 @@
+// ---------------------------------------------------------------------------
+// fixed_sieve.h : Word sieve specialized at compile time for one of the benchmark limits
+// ---------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <new>
+
+#include "bitmap_kernels.h"
+#include "page_buffer.h"
+#include "popcount.h"
+#include "presieve.h"
+#include "prime_writer.h"
+#include "sieve_common.h"
+
+// constexprSqrt
+//
+// Largest r with r*r <= n, by Newton's method, usable in constant expressions.
+
+constexpr uint64_t constexprSqrt(uint64_t n)
+{
+    if (n < 2)
+        return n;
+    uint64_t x = n, y = (x + 1) / 2;
+    while (y < x)
+    {
+        x = y;
+        y = (x + n / x) / 2;
+    }
+    return x;
+}
+
+// reference_sieve
+//
+// The odd-only bitmap for Limit worked out entirely by the compiler, in the same layout as the word sieves
+// (bit 0 set in place of 2, nothing past the last bit).  Only meant for small limits: it costs compile time
+// and its words end up in the binary.  A static_assert checks its count against the historical data.
+
+const uint64_t REFERENCE_SIEVE_MAX_LIMIT = 100'000;
+
+template <uint64_t Limit>
+struct reference_sieve
+{
+    static_assert(Limit <= REFERENCE_SIEVE_MAX_LIMIT, "reference tables are only built for small limits");
+
+    static constexpr uint64_t cBits  = Limit >> 1;
+    static constexpr uint64_t cWords = (cBits + 63) >> 6;
+
+    static constexpr std::array<uint64_t, std::max<uint64_t>(cWords, 1)> build()
+    {
+        std::array<uint64_t, std::max<uint64_t>(cWords, 1)> words{};
+        for (uint64_t w = 0; w < cWords; w++)
+            words[w] = ~0ULL;
+        if (cBits & 63)
+            words[cWords - 1] = (1ULL << (cBits & 63)) - 1;
+
+        for (uint64_t factor = 1; 2 * factor * (factor + 1) < cBits; factor++)
+        {
+            if (!((words[factor >> 6] >> (factor & 63)) & 1))
+                continue;
+            for (uint64_t num = 2 * factor * (factor + 1); num < cBits; num += 2 * factor + 1)
+                words[num >> 6] &= ~(1ULL << (num & 63));
+        }
+        return words;
+    }
+
+    static constexpr std::array<uint64_t, std::max<uint64_t>(cWords, 1)> words = build();
+
+    static constexpr size_t count()
+    {
+        if (Limit <= 2)
+            return 0;
+        size_t total = 0;
+        for (uint64_t w = 0; w < cWords; w++)
+            total += __builtin_popcountll(words[w]);
+        return total;
+    }
+
+    static_assert(expectedPrimeCount(Limit) == 0 || count() == expectedPrimeCount(Limit),
+                  "compile-time sieve disagrees with the historical data");
+};
+
+// prime_sieve_fixed
+//
+// prime_sieve_words with the limit as a template parameter: the bitmap is a std::array whose size, sqrt of
+// the limit and expected count are all compile-time constants, so the compiler can fold every loop bound.
+// The array is placed in a buffer from page_buffer.h rather than inside the object, since at the larger
+// limits it would not fit on a stack.  At limits up to REFERENCE_SIEVE_MAX_LIMIT validateResults compares
+// the whole bitmap with reference_sieve, not just the count.
+
+template <uint64_t Limit>
+class prime_sieve_fixed
+{
+  public:
+
+      static constexpr uint64_t cBits         = Limit >> 1;
+      static constexpr uint64_t cWords        = std::max<uint64_t>((cBits + 63) >> 6, 1);
+      static constexpr uint64_t sqrtLimit     = constexprSqrt(Limit);
+      static constexpr size_t   expectedCount = expectedPrimeCount(Limit);
+
+      typedef std::array<uint64_t, cWords> word_array;
+
+  protected:
+
+      struct array_deleter
+      {
+          void operator()(word_array *p) const
+          {
+              freePages(p, sizeof(word_array));
+          }
+      };
+
+      std::unique_ptr<word_array, array_deleter> Words;        // Sieve data, where 1==prime, 0==not
+
+      bool getBit(uint64_t num) const
+      {
+          return ((*Words)[num >> 6] >> (num & 63)) & 1;
+      }
+
+   public:
+
+      // The runtime limit is only taken so that the runners can construct every engine the same way
+      prime_sieve_fixed(uint64_t n = Limit) : Words(new (allocatePages(sizeof(word_array))) word_array)
+      {
+          (void) n;
+          reset();
+      }
+
+      void reset()
+      {
+          presieve_pattern::get().fill(Words->data(), 0, cWords);
+          if (cBits & 63)
+              (*Words)[cWords - 1] &= (1ULL << (cBits & 63)) - 1;
+      }
+
+      // runSieve
+      //
+      // As prime_sieve_words::runSieve, but sieving primes stop at the constant sqrt(Limit).
+
+      void runSieve()
+      {
+          uint64_t *words = Words->data();
+          for (uint64_t factor = presieve_pattern::get().firstSievingBit(); (factor << 1) + 1 <= sqrtLimit; factor++)
+          {
+              uint64_t w = factor >> 6;
+              uint64_t bits = words[w] & (~0ULL << (factor & 63));
+              while (!bits && ++w < cWords)
+                  bits = words[w];
+              if (!bits)
+                  break;
+              factor = (w << 6) + __builtin_ctzll(bits);
+
+              uint64_t p = (factor << 1) + 1;
+              if (p > sqrtLimit)
+                  break;
+              crossOff(words, p, 2 * factor * (factor + 1), cBits);
+          }
+      }
+
+      size_t countPrimes() const
+      {
+          if (Limit <= 2)
+              return 0;
+          return countBits(Words->data(), 0, cBits);
+      }
+
+      bool isPrime(uint64_t n) const
+      {
+          if (n == 2)
+              return Limit > 2;
+          if (!(n & 1) || n == 1 || n >= Limit)
+              return false;
+          return getBit(n >> 1);
+      }
+
+      bool matchesReference() const
+      {
+          if constexpr (Limit <= REFERENCE_SIEVE_MAX_LIMIT)
+              return std::equal(Words->begin(), Words->end(), reference_sieve<Limit>::words.begin());
+          else
+              return true;
+      }
+
+      bool validateResults() const
+      {
+          return countPrimes() == expectedCount && matchesReference();
+      }
+
+      // printResults
+      //
+      // Displays stats about what was found as well as (optionally) the primes themselves
+
+      void printResults(bool showResults, double duration, size_t passes, size_t threads) const
+      {
+          size_t count = countPrimes();
+
+          if (showResults)
+          {
+              prime_writer writer;
+              if (Limit > 2)
+                  writer.put(2);
+              writer.putOddBits(Words->data(), 1, cBits);
+              writer.finish();
+          }
+
+          std::cout << "Passes: "  << passes << ", "
+                    << "Threads: " << threads << ", "
+                    << "Time: "    << duration << ", "
+                    << "Average: " << duration/passes << ", "
+                    << "Per second: " << passes/duration << ", "
+                    << "Limit: "   << Limit << " (fixed), "
+                    << "Count: "   << count << ", "
+                    << "Valid : "  << (count == expectedCount && matchesReference() ? "Pass" : "FAIL!")
+                    << "\n";
+      }
+};
+
+// withFixedSieve
+//
+// Maps a runtime limit onto its prime_sieve_fixed instantiation, or onto Fallback for limits that have none,
+// and calls fn with a null pointer of that type to say which one it is.
+
+template <typename Fallback, typename Fn>
+auto withFixedSieve(uint64_t limit, Fn &&fn)
+{
+    switch (limit)
+    {
+        case             10LLU: return fn((prime_sieve_fixed<10LLU> *) nullptr);
+        case            100LLU: return fn((prime_sieve_fixed<100LLU> *) nullptr);
+        case          1'000LLU: return fn((prime_sieve_fixed<1'000LLU> *) nullptr);
+        case         10'000LLU: return fn((prime_sieve_fixed<10'000LLU> *) nullptr);
+        case        100'000LLU: return fn((prime_sieve_fixed<100'000LLU> *) nullptr);
+        case      1'000'000LLU: return fn((prime_sieve_fixed<1'000'000LLU> *) nullptr);
+        case     10'000'000LLU: return fn((prime_sieve_fixed<10'000'000LLU> *) nullptr);
+        case    100'000'000LLU: return fn((prime_sieve_fixed<100'000'000LLU> *) nullptr);
+        case  1'000'000'000LLU: return fn((prime_sieve_fixed<1'000'000'000LLU> *) nullptr);
+        case 10'000'000'000LLU: return fn((prime_sieve_fixed<10'000'000'000LLU> *) nullptr);
+    }
+    return fn((Fallback *) nullptr);
+}
@@ -0,0 +1,63 @@
+// ---------------------------------------------------------------------------
+// linear_sieve.h : Linear (Euler) sieve on the odd-only word layout
+// ---------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "word_sieve.h"
+
+// prime_sieve_linear
+//
+// Euler's sieve, which clears every odd composite exactly once: c is cleared as p * i for its smallest prime
+// factor p, while i = c / p is being visited.  Every odd i below limit / 3 is visited, prime or not, and
+// runs through the primes p up to the smallest factor of i, which the i % p == 0 test finds.  Such a p is
+// at most sqrt(limit), so only those primes are kept.  Linear work, but a division per clear where the
+// Eratosthenes engines have none; it is here to be measured against them.
+//
+// There is no presieve: it would clear composites before their turn, which breaks nothing but is no longer
+// Euler's sieve.
+
+class prime_sieve_linear : public prime_sieve_words
+{
+  protected:
+
+      std::vector<uint32_t> primes;                             // Odd primes below sqrt(limit) found so far
+
+   public:
+
+      prime_sieve_linear(uint64_t n) : prime_sieve_words(n, false)
+      {
+      }
+
+      // runSieve fills the bitmap itself, so there is nothing to reset
+      void reset()
+      {
+      }
+
+      void runSieve()
+      {
+          for (uint64_t w = 0; w < cWords; w++)
+              Words[w] = ~0ULL;
+          if (cBits & 63)
+              Words[cWords - 1] &= (1ULL << (cBits & 63)) - 1;
+
+          primes.clear();
+          for (uint64_t i = 3; 3 * i < limit; i += 2)
+          {
+              if (getBit(i >> 1) && i * i < limit)
+                  primes.push_back((uint32_t) i);
+
+              for (uint64_t p : primes)
+              {
+                  if (p * i >= limit)
+                      break;
+                  clearBit((p * i) >> 1);
+                  if (i % p == 0)
+                      break;
+              }
+          }
+      }
+};
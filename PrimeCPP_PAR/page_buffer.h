@@ -0,0 +1,467 @@
+// ---------------------------------------------------------------------------
+// page_buffer.h : Sieve buffers backed by huge pages and placed on the local NUMA node
+// ---------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if defined(__linux__)
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "cpu_topology.h"
+
+const size_t HUGE_PAGE_SIZE = 2 << 20;
+
+// page_policy
+//
+// Where sieve buffers come from: the heap, anonymous mappings advised for transparent huge pages, or
+// explicit hugetlbfs pages (which need pages reserved in /proc/sys/vm/nr_hugepages and fall back to
+// transparent ones when there are none).  "auto" maps buffers of a huge page or more and leaves smaller ones
+// to the heap, where a huge page would mostly be wasted.
+
+enum class page_policy { heap, thp, hugetlb, automatic };
+
+struct page_options
+{
+    page_policy policy = page_policy::automatic;
+
+    static page_options &get()
+    {
+        static page_options options;
+        return options;
+    }
+
+    static bool parsePolicy(const std::string &name, page_policy &policy)
+    {
+        if (name == "heap")
+            policy = page_policy::heap;
+        else if (name == "thp")
+            policy = page_policy::thp;
+        else if (name == "huge")
+            policy = page_policy::hugetlb;
+        else if (name == "auto")
+            policy = page_policy::automatic;
+        else
+            return false;
+        return true;
+    }
+
+    // Whether a buffer of this size is mapped rather than taken from the heap.  The policy is fixed before
+    // the first allocation, so this answers the same when the buffer is freed.
+    bool mapsPages(size_t bytes) const
+    {
+#if defined(__linux__)
+        return policy == page_policy::thp || policy == page_policy::hugetlb
+            || (policy == page_policy::automatic && bytes >= HUGE_PAGE_SIZE);
+#else
+        (void) bytes;
+        return false;
+#endif
+    }
+};
+
+inline size_t mappedLength(size_t bytes)
+{
+    return (std::max<size_t>(bytes, 1) + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+}
+
+// page_report
+//
+// Remembers the most recent mapping so that the runners can report which page size it actually got.
+
+struct page_report
+{
+    std::mutex lock;
+    const void *address = nullptr;
+    size_t length = 0;
+
+    static page_report &get()
+    {
+        static page_report report;
+        return report;
+    }
+
+    void record(const void *p, size_t bytes)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        address = p;
+        length  = bytes;
+    }
+
+    // describe
+    //
+    // Looks the mapping up in /proc/self/smaps: hugetlb mappings show their page size as KernelPageSize,
+    // transparent huge pages show up as AnonHugePages.  Only meaningful while the buffer is still alive.
+
+    std::string describe()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!address)
+            return "4 kB (heap)";
+
+        std::ifstream smaps("/proc/self/smaps");
+        std::string line;
+        bool bInside = false;
+        size_t kernelPageKB = 0, rssKB = 0, anonHugeKB = 0;
+        while (std::getline(smaps, line))
+        {
+            uintptr_t start, end;
+            char dash;
+            std::istringstream header(line);
+            if (header >> std::hex >> start >> dash >> end && dash == '-')
+            {
+                if (bInside)
+                    break;
+                bInside = (uintptr_t) address >= start && (uintptr_t) address < end;
+                continue;
+            }
+            if (!bInside)
+                continue;
+            std::istringstream field(line);
+            std::string key;
+            size_t value = 0;
+            field >> key >> value;
+            if (key == "KernelPageSize:")
+                kernelPageKB = value;
+            else if (key == "Rss:")
+                rssKB = value;
+            else if (key == "AnonHugePages:")
+                anonHugeKB = value;
+        }
+
+        std::ostringstream out;
+        if (!bInside)
+            out << "unknown (mapping not found)";
+        else if (kernelPageKB >= 2048)
+            out << kernelPageKB << " kB (hugetlbfs, " << length / 1048576.0 << " MB)";
+        else if (anonHugeKB > 0)
+            out << "2048 kB (transparent, " << (rssKB ? anonHugeKB * 100 / rssKB : 0) << "% of "
+                << rssKB / 1024.0 << " MB resident)";
+        else
+            out << kernelPageKB << " kB (no huge pages granted, " << length / 1048576.0 << " MB)";
+        return out.str();
+    }
+};
+
+// bindToLocalNode
+//
+// Prefers the NUMA node of the CPU we are running on for the pages of this range.  The default policy
+// already places pages where they are first touched, but this also holds when the process was started
+// with some other policy, and costs nothing on single-node machines where we skip it.
+
+inline void bindToLocalNode(void *p, size_t length)
+{
+#if defined(__linux__) && defined(SYS_mbind)
+    const cpu_topology &topology = cpu_topology::get();
+    if (topology.numaNodes() < 2)
+        return;
+    int cpu = sched_getcpu();
+    for (const auto &c : topology.cpus)
+    {
+        if ((int) c.id != cpu || c.node < 0 || c.node >= 64)
+            continue;
+        unsigned long nodemask = 1UL << c.node;
+        syscall(SYS_mbind, p, length, MPOL_PREFERRED, &nodemask, 64, 0);
+        return;
+    }
+#else
+    (void) p;
+    (void) length;
+#endif
+}
+
+// mapPages
+//
+// A buffer of at least 'bytes', mapped per page_options when it is large enough and from the heap
+// otherwise.  Nothing is touched here: the pages are faulted in by whoever writes them first, which for the
+// sieves is the thread that initializes and sieves that part of the bitmap.
+
+inline void *mapPages(size_t bytes, bool bLocalNode)
+{
+    const page_options &options = page_options::get();
+    if (!options.mapsPages(bytes))
+    {
+        void *p = aligned_alloc(64, (std::max<size_t>(bytes, 1) + 63) & ~size_t(63));
+        if (!p)
+            throw std::bad_alloc();
+        return p;
+    }
+
+#if defined(__linux__)
+    size_t length = mappedLength(bytes);
+    void *p = MAP_FAILED;
+
+    if (options.policy == page_policy::hugetlb)
+    {
+        p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED)
+        {
+            page_report::get().record(p, length);
+            if (bLocalNode)
+                bindToLocalNode(p, length);
+            return p;
+        }
+    }
+
+    // Transparent huge pages need 2 MB alignment, so map a huge page more than needed and trim both ends
+    char *raw = (char *) mmap(nullptr, length + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED)
+        throw std::bad_alloc();
+    char *aligned = (char *) (((uintptr_t) raw + HUGE_PAGE_SIZE - 1) & ~(uintptr_t) (HUGE_PAGE_SIZE - 1));
+    if (aligned > raw)
+        munmap(raw, aligned - raw);
+    if (raw + HUGE_PAGE_SIZE > aligned)
+        munmap(aligned + length, raw + HUGE_PAGE_SIZE - aligned);
+
+    madvise(aligned, length, MADV_HUGEPAGE);                    // Fails harmlessly where THP is disabled
+    if (bLocalNode)
+        bindToLocalNode(aligned, length);
+    page_report::get().record(aligned, length);
+    return aligned;
+#else
+    return nullptr;
+#endif
+}
+
+inline void unmapPages(void *p, size_t bytes)
+{
+#if defined(__linux__)
+    if (page_options::get().mapsPages(bytes))
+    {
+        munmap(p, mappedLength(bytes));
+        return;
+    }
+#endif
+    free(p);
+}
+
+// allocation_stats
+//
+// How many buffers were really allocated, and how many were handed out again from an arena instead.
+
+struct allocation_stats
+{
+    std::atomic<uint64_t> cAllocations{ 0 };
+    std::atomic<uint64_t> cReused{ 0 };
+
+    static allocation_stats &get()
+    {
+        static allocation_stats stats;
+        return stats;
+    }
+};
+
+// buffer_arena
+//
+// Per-thread cache of released sieve buffers.  A thread that sieves pass after pass at one limit frees and
+// allocates the same size every time, so the buffer it gives back is the one it gets next: no mmap, no page
+// faults, and the pages stay on the node they were first touched on.  Only a few buffers are kept; the rest
+// are released, as is everything when the thread exits.
+//
+// A request that none of them fits means the thread has moved on to another size (the next engine or limit,
+// a growing vector), so the whole cache is released before anything new is mapped.  What the arena holds is
+// then never on top of a new allocation, and peak memory is what it would be without it.
+
+class buffer_arena
+{
+  protected:
+
+      static const size_t MAX_CACHED = 4;
+
+      struct block
+      {
+          void *p;
+          size_t bytes;
+      };
+      std::vector<block> blocks;
+
+   public:
+
+      static bool &enabled()
+      {
+          static bool bEnabled = true;
+          return bEnabled;
+      }
+
+      static buffer_arena &local()
+      {
+          thread_local buffer_arena arena;
+          return arena;
+      }
+
+      ~buffer_arena()
+      {
+          release();
+      }
+
+      void *take(size_t bytes)
+      {
+          for (size_t i = blocks.size(); i-- > 0; )
+          {
+              if (blocks[i].bytes != bytes)
+                  continue;
+              void *p = blocks[i].p;
+              blocks.erase(blocks.begin() + i);
+              return p;
+          }
+          release();
+          return nullptr;
+      }
+
+      void release()
+      {
+          for (const auto &b : blocks)
+              unmapPages(b.p, b.bytes);
+          blocks.clear();
+      }
+
+      void give(void *p, size_t bytes)
+      {
+          if (blocks.size() == MAX_CACHED)
+          {
+              unmapPages(blocks.front().p, blocks.front().bytes);
+              blocks.erase(blocks.begin());
+          }
+          blocks.push_back({ p, bytes });
+      }
+};
+
+// allocatePages / freePages
+//
+// What the sieves use: a buffer from this thread's arena when one of the right size is there, a new one
+// from mapPages otherwise.
+
+inline void *allocatePages(size_t bytes, bool bLocalNode = true)
+{
+    if (buffer_arena::enabled())
+    {
+        if (void *p = buffer_arena::local().take(bytes))
+        {
+            allocation_stats::get().cReused.fetch_add(1, std::memory_order_relaxed);
+            if (page_options::get().mapsPages(bytes))
+                page_report::get().record(p, mappedLength(bytes));
+            return p;
+        }
+    }
+    allocation_stats::get().cAllocations.fetch_add(1, std::memory_order_relaxed);
+    return mapPages(bytes, bLocalNode);
+}
+
+inline void freePages(void *p, size_t bytes)
+{
+    if (!p)
+        return;
+    if (buffer_arena::enabled())
+        buffer_arena::local().give(p, bytes);
+    else
+        unmapPages(p, bytes);
+}
+
+// page_deleter / page_words
+//
+// The word engines keep their bitmap in a page_words, a unique_ptr that hands the buffer back to freePages.
+
+struct page_deleter
+{
+    size_t bytes = 0;
+
+    void operator()(uint64_t *p) const
+    {
+        freePages(p, bytes);
+    }
+};
+
+typedef std::unique_ptr<uint64_t[], page_deleter> page_words;
+
+inline page_words allocateWords(uint64_t cWords, bool bLocalNode = true)
+{
+    size_t bytes = std::max<uint64_t>(cWords, 1) * sizeof(uint64_t);
+    return page_words((uint64_t *) allocatePages(bytes, bLocalNode), page_deleter{ bytes });
+}
+
+// page_allocator
+//
+// The same, as a standard allocator, for prime_sieve's vector<bool>.
+
+template <typename T>
+struct page_allocator
+{
+    typedef T value_type;
+
+    page_allocator() = default;
+
+    template <typename U>
+    page_allocator(const page_allocator<U> &) {}
+
+    T *allocate(size_t n)
+    {
+        return (T *) allocatePages(n * sizeof(T));
+    }
+
+    void deallocate(T *p, size_t n)
+    {
+        freePages(p, n * sizeof(T));
+    }
+
+    template <typename U>
+    bool operator==(const page_allocator<U> &) const { return true; }
+
+    template <typename U>
+    bool operator!=(const page_allocator<U> &) const { return false; }
+};
+
+// memory_snapshot
+//
+// Allocation counters and page faults (minor and major, all threads) at one point in time, so a runner can
+// report how much of either each pass cost.
+
+struct memory_snapshot
+{
+    uint64_t cAllocations;
+    uint64_t cReused;
+    uint64_t cPageFaults;
+
+    memory_snapshot()
+    {
+        cAllocations = allocation_stats::get().cAllocations.load(std::memory_order_relaxed);
+        cReused      = allocation_stats::get().cReused.load(std::memory_order_relaxed);
+        cPageFaults  = 0;
+#if defined(__linux__)
+        rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) == 0)
+            cPageFaults = usage.ru_minflt + usage.ru_majflt;
+#endif
+    }
+
+    // describeSince
+    //
+    // "Allocations: 0.004 per pass (1 new, 249 reused), page faults: 0.1 per pass" for the passes run since
+    // the earlier snapshot.
+
+    std::string describeSince(const memory_snapshot &start, uint64_t cPasses) const
+    {
+        double passes = (double) std::max<uint64_t>(cPasses, 1);
+        std::ostringstream out;
+        out << "Allocations: " << (cAllocations - start.cAllocations) / passes << " per pass ("
+            << cAllocations - start.cAllocations << " new, " << cReused - start.cReused << " reused), page faults: "
+            << (cPageFaults - start.cPageFaults) / passes << " per pass";
+        return out.str();
+    }
+};
@@ -0,0 +1,217 @@
+// ---------------------------------------------------------------------------
+// pass_telemetry.h : Per-thread pass counters, pass latency histograms and the --live reporter
+// ---------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// Pass latencies are kept in log-linear buckets of nanoseconds: exact below 8, then eight buckets per power
+// of two, so a reported percentile is within 12.5% of the true value whatever the scale.
+
+const unsigned LATENCY_SUB_BUCKETS = 8;
+const unsigned LATENCY_BUCKETS     = 62 * LATENCY_SUB_BUCKETS;
+
+inline unsigned latencyBucket(uint64_t nanos)
+{
+    if (nanos < LATENCY_SUB_BUCKETS)
+        return (unsigned) nanos;
+    unsigned e = 63 - __builtin_clzll(nanos);
+    return (e - 2) * LATENCY_SUB_BUCKETS + ((nanos >> (e - 3)) & (LATENCY_SUB_BUCKETS - 1));
+}
+
+// The largest latency that lands in a bucket, which is what the percentiles report
+inline uint64_t latencyBucketLimit(unsigned bucket)
+{
+    if (bucket < LATENCY_SUB_BUCKETS)
+        return bucket;
+    unsigned e = bucket / LATENCY_SUB_BUCKETS + 2;
+    uint64_t low = (uint64_t) (LATENCY_SUB_BUCKETS + bucket % LATENCY_SUB_BUCKETS) << (e - 3);
+    return low + ((1ULL << (e - 3)) - 1);
+}
+
+// thread_pass_counter
+//
+// One worker's counts, on cache lines of its own so that no two workers ever write to the same line.  Only
+// the owning worker writes them, with a plain relaxed load and store rather than a locked read-modify-write;
+// the reporter reads them with relaxed loads, which is race-free and costs the worker nothing but the
+// occasional line transfer when a report is taken.
+
+struct alignas(64) thread_pass_counter
+{
+    std::atomic<uint64_t> passes{0};
+    std::atomic<uint64_t> latency[LATENCY_BUCKETS] = {};
+
+    static void bump(std::atomic<uint64_t> &value)
+    {
+        value.store(value.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+};
+
+// pass_snapshot
+//
+// The counts of every worker at one instant, and what the histograms add up to.
+
+struct pass_snapshot
+{
+    std::vector<uint64_t> threadPasses;
+    std::vector<uint64_t> latency = std::vector<uint64_t>(LATENCY_BUCKETS, 0);
+
+    uint64_t totalPasses() const
+    {
+        uint64_t total = 0;
+        for (auto n : threadPasses)
+            total += n;
+        return total;
+    }
+
+    // Nanoseconds at or below which 'fraction' of the passes since 'before' finished; 0 when there were none
+    uint64_t percentile(const pass_snapshot &before, double fraction) const
+    {
+        uint64_t cTotal = 0;
+        for (unsigned b = 0; b < LATENCY_BUCKETS; b++)
+            cTotal += latency[b] - before.latency[b];
+        if (cTotal == 0)
+            return 0;
+
+        uint64_t rank = std::max<uint64_t>(1, (uint64_t) (fraction * cTotal + 0.999999)), seen = 0;
+        for (unsigned b = 0; b < LATENCY_BUCKETS; b++)
+            if ((seen += latency[b] - before.latency[b]) >= rank)
+                return latencyBucketLimit(b);
+        return 0;
+    }
+};
+
+// pass_telemetry
+//
+// The counters of a timed run.  A worker calls recordPass after every pass; if latencies are wanted it times
+// the pass itself, with one clock read per pass, and otherwise nothing reads the clock but the timer.
+//
+// runTimer is the run's one timer: it sleeps until the deadline and raises the stop flag the workers poll.
+// With a live interval it wakes once per interval on the way and prints, to stderr so the results on stdout
+// stay as they were, the passes per second over that interval, the spread between the busiest and idlest
+// worker, and the p50, p99 and largest pass latency; printTotal gives the same for the whole run.
+
+class pass_telemetry
+{
+  protected:
+
+      std::unique_ptr<thread_pass_counter[]> counters;
+      unsigned cThreads;
+      bool bLatency;
+
+      static double toMilliseconds(uint64_t nanos)
+      {
+          return nanos / 1000000.0;
+      }
+
+      void printInterval(const char *label, const pass_snapshot &before, const pass_snapshot &now, double elapsed,
+                         double interval) const
+      {
+          uint64_t cMin = UINT64_MAX, cMax = 0, cPasses = 0;
+          for (unsigned i = 0; i < cThreads; i++)
+          {
+              uint64_t n = now.threadPasses[i] - before.threadPasses[i];
+              cMin = std::min(cMin, n);
+              cMax = std::max(cMax, n);
+              cPasses += n;
+          }
+          double mean = (double) cPasses / cThreads;
+
+          fprintf(stderr, "%s: %.2f s, Passes/s: %.1f, Per thread min/max: %lu/%lu (%.0f%%)",
+              label, elapsed, cPasses / interval, cMin, cMax, mean > 0 ? (cMax - cMin) * 100.0 / mean : 0.0);
+          if (bLatency)
+              fprintf(stderr, ", p50: %.3f ms, p99: %.3f ms, max: %.3f ms",
+                  toMilliseconds(now.percentile(before, 0.50)),
+                  toMilliseconds(now.percentile(before, 0.99)),
+                  toMilliseconds(now.percentile(before, 1.0)));
+          fprintf(stderr, "\n");
+      }
+
+   public:
+
+      pass_telemetry(unsigned threads, bool latency)
+        : counters(new thread_pass_counter[std::max(1u, threads)]), cThreads(std::max(1u, threads)), bLatency(latency)
+      {
+      }
+
+      bool recordsLatency() const
+      {
+          return bLatency;
+      }
+
+      void recordPass(unsigned thread)
+      {
+          thread_pass_counter::bump(counters[thread].passes);
+      }
+
+      void recordPass(unsigned thread, std::chrono::steady_clock::duration passTime)
+      {
+          thread_pass_counter &counter = counters[thread];
+          auto nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(passTime).count();
+          thread_pass_counter::bump(counter.latency[latencyBucket(std::max<int64_t>(nanos, 0))]);
+          thread_pass_counter::bump(counter.passes);
+      }
+
+      pass_snapshot snapshot() const
+      {
+          pass_snapshot snap;
+          snap.threadPasses.resize(cThreads);
+          for (unsigned i = 0; i < cThreads; i++)
+          {
+              snap.threadPasses[i] = counters[i].passes.load(std::memory_order_relaxed);
+              if (bLatency)
+                  for (unsigned b = 0; b < LATENCY_BUCKETS; b++)
+                      snap.latency[b] += counters[i].latency[b].load(std::memory_order_relaxed);
+          }
+          return snap;
+      }
+
+      uint64_t totalPasses() const
+      {
+          return snapshot().totalPasses();
+      }
+
+      // runTimer
+      //
+      // Returns once bStop is raised at tDeadline; liveInterval of zero means no reports.
+
+      void runTimer(std::chrono::steady_clock::time_point tStart, std::chrono::steady_clock::time_point tDeadline,
+                    std::atomic<bool> &bStop, double liveInterval) const
+      {
+          using namespace std::chrono;
+
+          pass_snapshot last = snapshot();
+          auto tLast = tStart;
+          while (liveInterval > 0 && tLast < tDeadline)
+          {
+              std::this_thread::sleep_until(std::min(tDeadline, tLast + duration_cast<steady_clock::duration>(duration<double>(liveInterval))));
+              auto now = snapshot();
+              auto tNow = steady_clock::now();
+              printInterval("Live", last, now, duration<double>(tNow - tStart).count(), duration<double>(tNow - tLast).count());
+              last = now;
+              tLast = tNow;
+          }
+
+          std::this_thread::sleep_until(tDeadline);
+          bStop.store(true, std::memory_order_relaxed);
+      }
+
+      // printTotal
+      //
+      // The live report for the whole run, once the workers have stopped.
+
+      void printTotal(double elapsed) const
+      {
+          pass_snapshot empty;
+          empty.threadPasses.assign(cThreads, 0);
+          printInterval("Live total", empty, snapshot(), elapsed, elapsed);
+      }
+};
@@ -0,0 +1,423 @@
+// ---------------------------------------------------------------------------
+// perf_profile.h : Per-phase hardware counters for --profile, read with perf_event_open
+// ---------------------------------------------------------------------------
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// sieve_phase
+//
+// What a pass spends its time on.  PHASE_SIEVE is whatever runSieve does outside the cross-off loops that
+// report themselves (finding the next factor or the seed primes), or the whole of it for an engine that
+// doesn't split its work up.  Small primes are those below SMALL_STRIDE_LIMIT, the ones the word engines
+// give to the rotating-mask kernel.
+
+enum sieve_phase
+{
+    PHASE_INIT,
+    PHASE_SIEVE,
+    PHASE_SMALL_PRIMES,
+    PHASE_LARGE_PRIMES,
+    PHASE_COUNT,
+    PHASE_TOTAL
+};
+
+const char *const SIEVE_PHASE_NAMES[PHASE_TOTAL] = { "init", "sieve", "small_primes", "large_primes", "count" };
+
+// The counters asked for, in report order
+
+struct perf_counter_spec
+{
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+};
+
+#if defined(__linux__)
+#define PERF_CACHE_EVENT(cache, result) \
+    ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | ((uint64_t) (result) << 16))
+
+const perf_counter_spec PERF_COUNTERS[] =
+{
+    { "cycles",        PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { "instructions",  PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { "l1d_misses",    PERF_TYPE_HW_CACHE, PERF_CACHE_EVENT(PERF_COUNT_HW_CACHE_L1D,  PERF_COUNT_HW_CACHE_RESULT_MISS) },
+    { "llc_misses",    PERF_TYPE_HW_CACHE, PERF_CACHE_EVENT(PERF_COUNT_HW_CACHE_LL,   PERF_COUNT_HW_CACHE_RESULT_MISS) },
+    { "dtlb_misses",   PERF_TYPE_HW_CACHE, PERF_CACHE_EVENT(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_RESULT_MISS) },
+    { "branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+};
+#undef PERF_CACHE_EVENT
+#else
+const perf_counter_spec PERF_COUNTERS[] =
+{
+    { "cycles", 0, 0 }, { "instructions", 0, 0 }, { "l1d_misses", 0, 0 },
+    { "llc_misses", 0, 0 }, { "dtlb_misses", 0, 0 }, { "branch_misses", 0, 0 },
+};
+#endif
+
+const size_t PERF_COUNTER_COUNT = sizeof(PERF_COUNTERS) / sizeof(PERF_COUNTERS[0]);
+
+// phase_totals
+//
+// What one thread accumulated in one phase.  Counter values are scaled by enabled/running time, in case the
+// kernel had to multiplex more events than the PMU has counters.
+
+struct phase_totals
+{
+    uint64_t calls = 0;
+    double seconds = 0;
+    double counts[PERF_COUNTER_COUNT] = {};
+
+    void add(const phase_totals &other)
+    {
+        calls += other.calls;
+        seconds += other.seconds;
+        for (size_t c = 0; c < PERF_COUNTER_COUNT; c++)
+            counts[c] += other.counts[c];
+    }
+};
+
+// thread_profiler
+//
+// The counters of one thread, opened by that thread for itself (user mode only, which needs no privileges at
+// the default perf_event_paranoid setting).  Any counter the kernel or the machine won't give us is left out
+// of the report; with none at all the phases are only timed.
+//
+// Phases nest: entering one charges everything since the last change to the phase it interrupts, and
+// leaving it goes back to that one, so the phases never double count.  Nothing is charged while no phase is
+// open.  Each change reads every counter, a handful of syscalls, so phases are marked per pass or per
+// segment and never per prime.
+
+class thread_profiler
+{
+  protected:
+
+      struct reading
+      {
+          std::chrono::steady_clock::time_point time;
+          uint64_t value[PERF_COUNTER_COUNT][3];                // value, time enabled, time running
+      };
+
+      int fds[PERF_COUNTER_COUNT];
+      phase_totals totals[PHASE_TOTAL];
+      sieve_phase stack[8];
+      int depth = 0;
+      reading last;
+
+      void read(reading &r) const
+      {
+          r.time = std::chrono::steady_clock::now();
+          for (size_t c = 0; c < PERF_COUNTER_COUNT; c++)
+          {
+#if defined(__linux__)
+              if (fds[c] >= 0 && ::read(fds[c], r.value[c], sizeof(r.value[c])) == sizeof(r.value[c]))
+                  continue;
+#endif
+              r.value[c][0] = r.value[c][1] = r.value[c][2] = 0;
+          }
+      }
+
+      // Charges everything since the last reading to the phase on top of the stack
+      void charge()
+      {
+          reading now;
+          read(now);
+          if (depth > 0 && depth <= (int) (sizeof(stack) / sizeof(stack[0])))
+          {
+              phase_totals &t = totals[stack[depth - 1]];
+              t.seconds += std::chrono::duration<double>(now.time - last.time).count();
+              for (size_t c = 0; c < PERF_COUNTER_COUNT; c++)
+              {
+                  uint64_t running = now.value[c][2] - last.value[c][2];
+                  uint64_t enabled = now.value[c][1] - last.value[c][1];
+                  if (running)
+                      t.counts[c] += (double) (now.value[c][0] - last.value[c][0]) * enabled / running;
+              }
+          }
+          last = now;
+      }
+
+   public:
+
+      const unsigned int index;                                 // Order in which the threads first reported
+
+      explicit thread_profiler(unsigned int threadIndex) : index(threadIndex)
+      {
+          for (size_t c = 0; c < PERF_COUNTER_COUNT; c++)
+          {
+              fds[c] = -1;
+#if defined(__linux__)
+              perf_event_attr attr;
+              memset(&attr, 0, sizeof(attr));
+              attr.size           = sizeof(attr);
+              attr.type           = PERF_COUNTERS[c].type;
+              attr.config         = PERF_COUNTERS[c].config;
+              attr.exclude_kernel = 1;
+              attr.exclude_hv     = 1;
+              attr.read_format    = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+              fds[c] = (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+          }
+          read(last);
+      }
+
+      ~thread_profiler()
+      {
+#if defined(__linux__)
+          for (int fd : fds)
+              if (fd >= 0)
+                  close(fd);
+#endif
+      }
+
+      thread_profiler(const thread_profiler &) = delete;
+      thread_profiler &operator=(const thread_profiler &) = delete;
+
+      bool hasCounter(size_t c) const
+      {
+          return fds[c] >= 0;
+      }
+
+      bool hasCounters() const
+      {
+          for (size_t c = 0; c < PERF_COUNTER_COUNT; c++)
+              if (hasCounter(c))
+                  return true;
+          return false;
+      }
+
+      const phase_totals &phase(sieve_phase p) const
+      {
+          return totals[p];
+      }
+
+      void enter(sieve_phase p)
+      {
+          charge();
+          if (depth < (int) (sizeof(stack) / sizeof(stack[0])))
+              stack[depth] = p;
+          depth++;
+          totals[p].calls++;
+      }
+
+      void switchTo(sieve_phase p)
+      {
+          charge();
+          if (depth > 0 && depth <= (int) (sizeof(stack) / sizeof(stack[0])))
+              stack[depth - 1] = p;
+          totals[p].calls++;
+      }
+
+      void leave()
+      {
+          charge();
+          depth--;
+      }
+};
+
+// profile_session
+//
+// The profilers of one profiled run.  A thread gets its profiler the first time it marks a phase during the
+// run, and keeps it until the run's report has been written; outside a run forThisThread is one relaxed
+// load and returns nullptr, which is all --profile costs when it is off.
+
+class profile_session
+{
+  protected:
+
+      std::mutex lock;
+      std::vector<std::unique_ptr<thread_profiler>> profilers;
+      std::atomic<bool> bActive{false};
+      std::atomic<uint64_t> generation{0};
+
+      thread_profiler *registerThread()
+      {
+          std::lock_guard<std::mutex> guard(lock);
+          profilers.emplace_back(new thread_profiler((unsigned int) profilers.size()));
+          return profilers.back().get();
+      }
+
+      static void writeTotals(std::ostream &out, const phase_totals &t, const bool *available)
+      {
+          out << "{\"calls\":" << t.calls << ",\"seconds\":" << t.seconds;
+          for (size_t c = 0; c < PERF_COUNTER_COUNT; c++)
+          {
+              out << ",\"" << PERF_COUNTERS[c].name << "\":";
+              if (available[c])
+                  out << (uint64_t) (t.counts[c] + 0.5);
+              else
+                  out << "null";
+          }
+          out << "}";
+      }
+
+      static void writePhases(std::ostream &out, const phase_totals *totals, const bool *available)
+      {
+          out << "{";
+          for (int p = 0; p < PHASE_TOTAL; p++)
+          {
+              out << (p ? "," : "") << "\"" << SIEVE_PHASE_NAMES[p] << "\":";
+              writeTotals(out, totals[p], available);
+          }
+          out << "}";
+      }
+
+   public:
+
+      bool bEnabled = false;                                    // Set by --profile
+      std::string outputPath;                                   // Empty for stdout
+
+      static profile_session &get()
+      {
+          static profile_session session;
+          return session;
+      }
+
+      void start()
+      {
+          std::lock_guard<std::mutex> guard(lock);
+          profilers.clear();
+          generation++;
+          bActive.store(bEnabled, std::memory_order_release);
+      }
+
+      void stop()
+      {
+          bActive.store(false, std::memory_order_release);
+      }
+
+      bool active() const
+      {
+          return bActive.load(std::memory_order_relaxed);
+      }
+
+      thread_profiler *forThisThread()
+      {
+          if (!bActive.load(std::memory_order_relaxed))
+              return nullptr;
+
+          thread_local uint64_t myGeneration = 0;
+          thread_local thread_profiler *myProfiler = nullptr;
+          uint64_t current = generation.load(std::memory_order_acquire);
+          if (myGeneration != current)
+          {
+              myProfiler = registerThread();
+              myGeneration = current;
+          }
+          return myProfiler;
+      }
+
+      // writeReport
+      //
+      // One JSON object on one line per profiled run, so a file of them can be read a line at a time.  A
+      // counter that couldn't be opened on every thread is reported as null throughout; "counters" says
+      // whether there were any at all or only the timings.  Call after stop(), once the workers are idle.
+
+      void writeReport(std::ostream &out, const std::string &engine, uint64_t limit, unsigned int threads,
+                       uint64_t passes, double seconds)
+      {
+          std::lock_guard<std::mutex> guard(lock);
+
+          bool available[PERF_COUNTER_COUNT];
+          bool bAny = false;
+          for (size_t c = 0; c < PERF_COUNTER_COUNT; c++)
+          {
+              available[c] = !profilers.empty();
+              for (auto &profiler : profilers)
+                  available[c] = available[c] && profiler->hasCounter(c);
+              bAny = bAny || available[c];
+          }
+
+          phase_totals total[PHASE_TOTAL];
+          out << "{\"engine\":\"" << engine << "\",\"limit\":" << limit << ",\"threads\":" << threads
+              << ",\"passes\":" << passes << ",\"seconds\":" << seconds
+              << ",\"counters\":\"" << (bAny ? "perf" : "timing") << "\",\"per_thread\":[";
+          for (auto &profiler : profilers)
+          {
+              phase_totals phases[PHASE_TOTAL];
+              for (int p = 0; p < PHASE_TOTAL; p++)
+              {
+                  phases[p] = profiler->phase((sieve_phase) p);
+                  total[p].add(phases[p]);
+              }
+              out << (profiler->index ? "," : "") << "{\"thread\":" << profiler->index << ",\"phases\":";
+              writePhases(out, phases, available);
+              out << "}";
+          }
+          out << "],\"total\":";
+          writePhases(out, total, available);
+          out << "}" << std::endl;
+      }
+
+      // finish
+      //
+      // Ends the run and writes its report to outputPath (appending) or stdout.
+
+      void finish(const std::string &engine, uint64_t limit, unsigned int threads, uint64_t passes, double seconds)
+      {
+          if (!active())
+              return;
+          stop();
+          if (outputPath.empty())
+          {
+              writeReport(std::cout, engine, limit, threads, passes, seconds);
+              return;
+          }
+          std::ofstream out(outputPath, std::ios::app);
+          if (out)
+              writeReport(out, engine, limit, threads, passes, seconds);
+          else
+              std::cerr << "Cannot write the profile to " << outputPath << std::endl;
+      }
+};
+
+// profile_phase
+//
+// Marks the enclosing scope as one phase of the pass, when a profiled run is going on.
+
+class profile_phase
+{
+  protected:
+
+      thread_profiler *profiler;
+
+   public:
+
+      explicit profile_phase(sieve_phase p) : profiler(profile_session::get().forThisThread())
+      {
+          if (profiler)
+              profiler->enter(p);
+      }
+
+      ~profile_phase()
+      {
+          if (profiler)
+              profiler->leave();
+      }
+
+      profile_phase(const profile_phase &) = delete;
+      profile_phase &operator=(const profile_phase &) = delete;
+
+      void switchTo(sieve_phase p)
+      {
+          if (profiler)
+              profiler->switchTo(p);
+      }
+};
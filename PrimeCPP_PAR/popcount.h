@@ -0,0 +1,211 @@
+// ---------------------------------------------------------------------------
+// popcount.h : Vectorized bit counting with runtime CPU dispatch
+// ---------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define POPCOUNT_X86 1
+#endif
+
+// Counting the primes is a popcount over the whole bitmap, which at 1e9..1e10 is tens to hundreds of MB and
+// runs again for every validation.  We pick the widest kernel the CPU supports the first time we're called:
+// AVX-512 VPOPCNTDQ, then AVX2 Harley-Seal, then the POPCNT instruction, then the compiler's builtin.
+
+typedef uint64_t (*popcount_kernel)(const uint64_t *, size_t);
+
+inline uint64_t popcountGeneric(const uint64_t *words, size_t n)
+{
+    uint64_t total = 0;
+    for (size_t i = 0; i < n; i++)
+        total += __builtin_popcountll(words[i]);
+    return total;
+}
+
+#ifdef POPCOUNT_X86
+
+// popcountScalar
+//
+// One POPCNT per word, with four accumulators so the adds don't serialize.
+
+__attribute__((target("popcnt")))
+inline uint64_t popcountScalar(const uint64_t *words, size_t n)
+{
+    uint64_t c0 = 0, c1 = 0, c2 = 0, c3 = 0;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        c0 += __builtin_popcountll(words[i]);
+        c1 += __builtin_popcountll(words[i + 1]);
+        c2 += __builtin_popcountll(words[i + 2]);
+        c3 += __builtin_popcountll(words[i + 3]);
+    }
+    for (; i < n; i++)
+        c0 += __builtin_popcountll(words[i]);
+    return c0 + c1 + c2 + c3;
+}
+
+// popcountAvx2
+//
+// Harley-Seal: a tree of carry-save adders folds 16 vectors into ones/twos/fours/eights/sixteens, so the
+// expensive nibble-lookup popcount only runs once per 16 vectors (Mula, Kurz & Lemire).
+
+__attribute__((target("avx2")))
+inline __m256i popcount256(__m256i v)
+{
+    const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i lowMask = _mm256_set1_epi8(0x0f);
+    __m256i lo = _mm256_shuffle_epi8(lookup, _mm256_and_si256(v, lowMask));
+    __m256i hi = _mm256_shuffle_epi8(lookup, _mm256_and_si256(_mm256_srli_epi32(v, 4), lowMask));
+    return _mm256_sad_epu8(_mm256_add_epi8(lo, hi), _mm256_setzero_si256());
+}
+
+__attribute__((target("avx2")))
+inline void carrySaveAdd(__m256i &h, __m256i &l, __m256i a, __m256i b, __m256i c)
+{
+    __m256i u = _mm256_xor_si256(a, b);
+    h = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(u, c));
+    l = _mm256_xor_si256(u, c);
+}
+
+__attribute__((target("avx2")))
+inline uint64_t popcountAvx2(const uint64_t *words, size_t n)
+{
+    const __m256i *d = reinterpret_cast<const __m256i *>(words);
+    size_t cVectors = n / 4;
+
+    __m256i total    = _mm256_setzero_si256();
+    __m256i ones     = _mm256_setzero_si256();
+    __m256i twos     = _mm256_setzero_si256();
+    __m256i fours    = _mm256_setzero_si256();
+    __m256i eights   = _mm256_setzero_si256();
+    __m256i sixteens, twosA, twosB, foursA, foursB, eightsA, eightsB;
+
+    size_t i = 0;
+    for (; i + 16 <= cVectors; i += 16)
+    {
+        carrySaveAdd(twosA,    ones,   ones,   _mm256_loadu_si256(d + i + 0),  _mm256_loadu_si256(d + i + 1));
+        carrySaveAdd(twosB,    ones,   ones,   _mm256_loadu_si256(d + i + 2),  _mm256_loadu_si256(d + i + 3));
+        carrySaveAdd(foursA,   twos,   twos,   twosA, twosB);
+        carrySaveAdd(twosA,    ones,   ones,   _mm256_loadu_si256(d + i + 4),  _mm256_loadu_si256(d + i + 5));
+        carrySaveAdd(twosB,    ones,   ones,   _mm256_loadu_si256(d + i + 6),  _mm256_loadu_si256(d + i + 7));
+        carrySaveAdd(foursB,   twos,   twos,   twosA, twosB);
+        carrySaveAdd(eightsA,  fours,  fours,  foursA, foursB);
+        carrySaveAdd(twosA,    ones,   ones,   _mm256_loadu_si256(d + i + 8),  _mm256_loadu_si256(d + i + 9));
+        carrySaveAdd(twosB,    ones,   ones,   _mm256_loadu_si256(d + i + 10), _mm256_loadu_si256(d + i + 11));
+        carrySaveAdd(foursA,   twos,   twos,   twosA, twosB);
+        carrySaveAdd(twosA,    ones,   ones,   _mm256_loadu_si256(d + i + 12), _mm256_loadu_si256(d + i + 13));
+        carrySaveAdd(twosB,    ones,   ones,   _mm256_loadu_si256(d + i + 14), _mm256_loadu_si256(d + i + 15));
+        carrySaveAdd(foursB,   twos,   twos,   twosA, twosB);
+        carrySaveAdd(eightsB,  fours,  fours,  foursA, foursB);
+        carrySaveAdd(sixteens, eights, eights, eightsA, eightsB);
+        total = _mm256_add_epi64(total, popcount256(sixteens));
+    }
+
+    total = _mm256_slli_epi64(total, 4);
+    total = _mm256_add_epi64(total, _mm256_slli_epi64(popcount256(eights), 3));
+    total = _mm256_add_epi64(total, _mm256_slli_epi64(popcount256(fours), 2));
+    total = _mm256_add_epi64(total, _mm256_slli_epi64(popcount256(twos), 1));
+    total = _mm256_add_epi64(total, popcount256(ones));
+    for (; i < cVectors; i++)
+        total = _mm256_add_epi64(total, popcount256(_mm256_loadu_si256(d + i)));
+
+    uint64_t count = (uint64_t) _mm256_extract_epi64(total, 0) + (uint64_t) _mm256_extract_epi64(total, 1)
+                   + (uint64_t) _mm256_extract_epi64(total, 2) + (uint64_t) _mm256_extract_epi64(total, 3);
+    for (size_t w = cVectors * 4; w < n; w++)
+        count += __builtin_popcountll(words[w]);
+    return count;
+}
+
+// popcountAvx512
+//
+// VPOPCNTDQ counts eight words per instruction; the ragged end is a masked load.
+
+__attribute__((target("avx512f,avx512vpopcntdq")))
+inline uint64_t popcountAvx512(const uint64_t *words, size_t n)
+{
+    __m512i acc0 = _mm512_setzero_si512();
+    __m512i acc1 = _mm512_setzero_si512();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        acc0 = _mm512_add_epi64(acc0, _mm512_popcnt_epi64(_mm512_loadu_si512(words + i)));
+        acc1 = _mm512_add_epi64(acc1, _mm512_popcnt_epi64(_mm512_loadu_si512(words + i + 8)));
+    }
+    for (; i + 8 <= n; i += 8)
+        acc0 = _mm512_add_epi64(acc0, _mm512_popcnt_epi64(_mm512_loadu_si512(words + i)));
+    if (i < n)
+    {
+        __mmask8 mask = (__mmask8) ((1u << (n - i)) - 1);
+        acc1 = _mm512_add_epi64(acc1, _mm512_popcnt_epi64(_mm512_maskz_loadu_epi64(mask, words + i)));
+    }
+    return (uint64_t) _mm512_reduce_add_epi64(_mm512_add_epi64(acc0, acc1));
+}
+
+#endif
+
+struct popcount_dispatch
+{
+    popcount_kernel kernel;
+    const char *name;
+
+    popcount_dispatch() : kernel(popcountGeneric), name("generic")
+    {
+#ifdef POPCOUNT_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512vpopcntdq"))
+            kernel = popcountAvx512, name = "avx512-vpopcntdq";
+        else if (__builtin_cpu_supports("avx2"))
+            kernel = popcountAvx2, name = "avx2-harley-seal";
+        else if (__builtin_cpu_supports("popcnt"))
+            kernel = popcountScalar, name = "popcnt";
+#endif
+    }
+
+    static const popcount_dispatch &get()
+    {
+        static const popcount_dispatch dispatch;
+        return dispatch;
+    }
+};
+
+inline const char *popcountKernelName()
+{
+    return popcount_dispatch::get().name;
+}
+
+// popcountWords
+//
+// Number of set bits in words[0..n).
+
+inline uint64_t popcountWords(const uint64_t *words, size_t n)
+{
+    return popcount_dispatch::get().kernel(words, n);
+}
+
+// countBits
+//
+// Number of set bits at bit indexes [first, last) of a bitmap, masking off the partial words at either end.
+
+inline uint64_t countBits(const uint64_t *words, uint64_t first, uint64_t last)
+{
+    if (first >= last)
+        return 0;
+
+    uint64_t firstWord = first >> 6;
+    uint64_t lastWord  = (last - 1) >> 6;
+    uint64_t headMask  = ~0ULL << (first & 63);
+    uint64_t tailMask  = ~0ULL >> (63 - ((last - 1) & 63));
+
+    if (firstWord == lastWord)
+        return __builtin_popcountll(words[firstWord] & headMask & tailMask);
+
+    return __builtin_popcountll(words[firstWord] & headMask)
+         + popcountWords(words + firstWord + 1, lastWord - firstWord - 1)
+         + __builtin_popcountll(words[lastWord] & tailMask);
+}
@@ -0,0 +1,113 @@
+// ---------------------------------------------------------------------------
+// presieve.h : Pre-sieved initialization pattern for the word-based sieves
+// ---------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "bitmap_kernels.h"
+
+// presieve_pattern
+//
+// The multiples of 3, 5, 7, 11 and 13 repeat every 3*5*7*11*13 = 15015 odd numbers.  Rather than filling a
+// fresh sieve with all ones and then spending most of runSieve on those densest strides, we build one tile of
+// 15015 words (64 periods, so it ends on a word boundary) with them already crossed off and memcpy it into
+// place.  Optionally 17 and 19 are applied on top with their rotating word masks, one AND per word.  The
+// engines then start sieving at the first prime past the pattern.
+
+const uint32_t PRESIEVE_PRIMES[]    = { 3, 5, 7, 11, 13, 17, 19 };
+const uint64_t PRESIEVE_TILE_WORDS  = 3 * 5 * 7 * 11 * 13;
+
+class presieve_pattern
+{
+  protected:
+
+      std::vector<uint64_t> tile;
+      uint32_t largest = 13;                                    // Largest prime in the pattern, 0 if disabled
+
+      presieve_pattern() : tile(PRESIEVE_TILE_WORDS, ~0ULL)
+      {
+          for (uint64_t p = 3; p <= 13; p += 2)
+          {
+              if (p == 9)
+                  continue;
+              for (uint64_t num = p >> 1; num < PRESIEVE_TILE_WORDS * 64; num += p)
+                  tile[num >> 6] &= ~(1ULL << (num & 63));
+          }
+      }
+
+   public:
+
+      static presieve_pattern &get()
+      {
+          static presieve_pattern pattern;
+          return pattern;
+      }
+
+      // setLargestPrime
+      //
+      // 13 for the tile alone, 19 to add 17 and 19 on top, 0 to fall back to an all-ones fill.
+
+      void setLargestPrime(uint32_t p)
+      {
+          largest = p >= 19 ? 19 : p >= 17 ? 17 : p >= 13 ? 13 : 0;
+      }
+
+      uint32_t largestPrime() const
+      {
+          return largest;
+      }
+
+      // The first bit index a sieve still has to look at for factors
+      uint64_t firstSievingBit() const
+      {
+          return (largest >> 1) + 1;
+      }
+
+      // fill
+      //
+      // Initializes words [firstWord, lastWord) of an odd-only bitmap, bit i being 2i+1.  Any of the
+      // pattern's own primes that fall inside the range are set again afterwards.  A bitmap that doesn't start
+      // at 1 passes baseWord, the absolute index of its word 0, so the pattern lines up with the numbers.
+
+      void fill(uint64_t *words, uint64_t firstWord, uint64_t lastWord, uint64_t baseWord = 0) const
+      {
+          if (largest == 0)
+          {
+              std::fill(words + firstWord, words + lastWord, ~0ULL);
+              return;
+          }
+
+          uint64_t offset = (baseWord + firstWord) % PRESIEVE_TILE_WORDS;
+          for (uint64_t w = firstWord; w < lastWord; )
+          {
+              uint64_t n = std::min(PRESIEVE_TILE_WORDS - offset, lastWord - w);
+              memcpy(words + w, &tile[offset], n * sizeof(uint64_t));
+              w += n;
+              offset = 0;
+          }
+
+          for (uint64_t p = 17; p <= largest; p += 2)
+          {
+              const uint64_t *masks = small_stride_masks::get().forPrime(p);
+              uint64_t phase = (baseWord + firstWord) % p;
+              for (uint64_t w = firstWord; w < lastWord; w++)
+              {
+                  words[w] &= masks[phase];
+                  if (++phase == p)
+                      phase = 0;
+              }
+          }
+
+          for (uint32_t p : PRESIEVE_PRIMES)
+          {
+              uint64_t num = p >> 1;
+              if (p <= largest && num >= ((baseWord + firstWord) << 6) && num < ((baseWord + lastWord) << 6))
+                  words[(num >> 6) - baseWord] |= 1ULL << (num & 63);
+          }
+      }
+};
@@ -0,0 +1,371 @@
+// ---------------------------------------------------------------------------
+// prime_count.h : Counting primes below a limit without sieving up to it (Lucy_Hedgehog, Meissel-Lehmer)
+// ---------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "bitmap_kernels.h"
+
+// Both methods count the primes strictly below the limit, as the sieves do, by computing pi(limit - 1).
+
+inline uint64_t integerRoot(uint64_t n, int k)
+{
+    uint64_t r = (uint64_t) pow((double) n, 1.0 / k);
+    auto power = [k](uint64_t x)
+    {
+        unsigned __int128 p = 1;
+        for (int i = 0; i < k; i++)
+            p *= x;
+        return p;
+    };
+    while (r > 0 && power(r) > n)
+        r--;
+    while (power(r + 1) <= n)
+        r++;
+    return r;
+}
+
+// small_prime_table
+//
+// An odd-only bitmap of the primes up to some limit, with a running count every 512 bits so that pi(v) for
+// any v in the table is one lookup and at most eight popcounts.  This is the O(n^(2/3)) part of
+// Meissel-Lehmer, so it is kept to about a bit per odd number.
+
+class small_prime_table
+{
+  protected:
+
+      std::vector<uint64_t> words;                              // Bit i is 2i+1, bit 0 standing in for 2
+      std::vector<uint32_t> counts;                             // Primes in the bits before each block of 8 words
+      uint64_t limit;                                           // Covers [0, limit]
+
+   public:
+
+      small_prime_table(uint64_t n) : limit(std::max<uint64_t>(n, 2))
+      {
+          uint64_t cBits = (limit >> 1) + 1;
+          words.assign((cBits + 63) >> 6, ~0ULL);
+          if (cBits & 63)
+              words.back() = (1ULL << (cBits & 63)) - 1;
+
+          // Sieve in L2-sized segments, with the sieving primes from a plain sieve up to sqrt(limit)
+          uint64_t cSmallBits = (integerRoot(limit, 2) >> 1) + 1;
+          std::vector<bool> composite(cSmallBits);
+          std::vector<uint64_t> sievingPrimes, next;
+          for (uint64_t factor = 1; factor < cSmallBits; factor++)
+          {
+              if (composite[factor])
+                  continue;
+              uint64_t p = (factor << 1) + 1;
+              sievingPrimes.push_back(p);
+              next.push_back(2 * factor * (factor + 1));
+              for (uint64_t num = 2 * factor * (factor + 1); num < cSmallBits; num += p)
+                  composite[num] = true;
+          }
+
+          const uint64_t cSegmentBits = 1 << 21;
+          for (uint64_t first = 0; first < cBits; first += cSegmentBits)
+          {
+              uint64_t last = std::min(first + cSegmentBits, cBits);
+              for (size_t i = 0; i < sievingPrimes.size(); i++)
+              {
+                  if (next[i] >= last)
+                      continue;
+                  crossOff(&words[0], sievingPrimes[i], next[i], last);
+                  next[i] += (last - next[i] + sievingPrimes[i] - 1) / sievingPrimes[i] * sievingPrimes[i];
+              }
+          }
+
+          counts.resize((words.size() >> 3) + 1);
+          uint32_t total = 0;
+          for (size_t w = 0; w < words.size(); w++)
+          {
+              if (!(w & 7))
+                  counts[w >> 3] = total;
+              total += (uint32_t) __builtin_popcountll(words[w]);
+          }
+      }
+
+      uint64_t maxValue() const
+      {
+          return limit;
+      }
+
+      // Primes <= v, for v <= maxValue()
+      uint64_t pi(uint64_t v) const
+      {
+          if (v < 2)
+              return 0;
+          uint64_t bit = (v - 1) >> 1;                          // Last odd number <= v
+          uint64_t w = bit >> 6;
+          uint64_t total = counts[w >> 3];
+          for (uint64_t i = w & ~7ULL; i < w; i++)
+              total += __builtin_popcountll(words[i]);
+          return total + __builtin_popcountll(words[w] & (~0ULL >> (63 - (bit & 63))));
+      }
+
+      // Calls fn(p) for the primes in [first, last], in order
+      template <typename Fn>
+      void forEachPrime(uint64_t first, uint64_t last, Fn &&fn) const
+      {
+          if (first <= 2 && last >= 2)
+              fn(2);
+          for (uint64_t bit = std::max<uint64_t>(first, 3) >> 1; (bit << 1) + 1 <= last; )
+          {
+              uint64_t w = bit >> 6;
+              uint64_t bits = words[w] & (~0ULL << (bit & 63));
+              while (!bits && ++w < words.size())
+                  bits = words[w];
+              if (!bits)
+                  return;
+              bit = (w << 6) + __builtin_ctzll(bits);
+              if ((bit << 1) + 1 > last)
+                  return;
+              fn((bit << 1) + 1);
+              bit++;
+          }
+      }
+};
+
+// lucyPrimeCount
+//
+// Lucy_Hedgehog's method: S(v) starts as the count of 2..v for every v of the form n/i, and each prime p up
+// to sqrt(n) removes the numbers whose smallest factor is p with S(v) -= S(v/p) - S(p-1).  Those values fit
+// in two arrays of sqrt(n) entries.  O(n^(3/4)) time, so it is the simple cross-check rather than the fast
+// path.
+
+inline uint64_t lucyPrimeCount(uint64_t limit)
+{
+    if (limit <= 2)
+        return 0;
+    uint64_t n = limit - 1;
+    uint64_t r = integerRoot(n, 2);
+
+    std::vector<uint64_t> lo(r + 1), hi(r + 1);                 // lo[v] = S(v), hi[i] = S(n/i)
+    for (uint64_t i = 1; i <= r; i++)
+    {
+        lo[i] = i - 1;
+        hi[i] = n / i - 1;
+    }
+
+    for (uint64_t p = 2; p <= r; p++)
+    {
+        if (lo[p] == lo[p - 1])
+            continue;
+        uint64_t sp = lo[p - 1], p2 = p * p;
+        uint64_t last = std::min(r, n / p2);
+        for (uint64_t i = 1; i <= last; i++)
+        {
+            uint64_t d = i * p;
+            hi[i] -= (d <= r ? hi[d] : lo[n / d]) - sp;
+        }
+        for (uint64_t v = r; v >= p2; v--)
+            lo[v] -= lo[v / p] - sp;
+    }
+    return hi[1];
+}
+
+// lucyMemoryBytes
+//
+// What lucyPrimeCount allocates for a limit: the two arrays of sqrt(n) counts.
+
+inline uint64_t lucyMemoryBytes(uint64_t limit)
+{
+    return limit <= 2 ? 0 : 2 * (integerRoot(limit - 1, 2) + 1) * sizeof(uint64_t);
+}
+
+// meissel_lehmer
+//
+// pi(n) = phi(n, a) + a - 1 - P2(n, a), where a = pi(y) for some y >= cbrt(n), phi(x, a) counts the numbers
+// up to x with no prime factor among the first a primes, and P2 counts those up to n that are the product of
+// exactly two primes larger than y.  P2 needs pi(v) for v up to n/y, which comes from a small_prime_table.
+// phi is the usual recursion phi(x, a) = phi(x, a-1) - phi(x/p_a, a-1), cut short by:
+//
+//   - a wheel table for the first PHI_WHEEL_PRIMES primes, periodic in 2*3*5*7*11*13
+//   - a cache of phi(x, a) for x < PHI_CACHE_X and a < PHI_CACHE_PRIMES, where most of the leaves land
+//   - phi(x, a) = pi(x) - a + 1 once p_(a+1)^2 > x
+//
+// The cache is what keeps it practical past 1e12: without it the recursion is several times slower.  y is a
+// small multiple of cbrt(n), trading a longer phi recursion for a smaller table.
+
+class meissel_lehmer
+{
+  protected:
+
+      static constexpr int      PHI_WHEEL_PRIMES = 6;
+      static constexpr uint32_t PHI_WHEEL        = 2 * 3 * 5 * 7 * 11 * 13;
+      static constexpr size_t   PHI_CACHE_PRIMES = 100;
+      static constexpr uint64_t PHI_CACHE_X      = 1 << 21;
+      static constexpr uint64_t PHI_CACHE_MIN_N  = 10'000'000'000ULL;   // Below this the cache costs more than it saves
+
+      uint64_t n;
+      small_prime_table table;
+      std::vector<uint32_t> primes;                             // The first a primes, and one more
+      std::vector<uint16_t> phiWheel[PHI_WHEEL_PRIMES + 1];     // phi(r, k) for r < PHI_WHEEL
+      uint32_t phiWheelTotal[PHI_WHEEL_PRIMES + 1];             // phi(PHI_WHEEL, k)
+
+      // For a past the wheel: odd-only bitmaps of the numbers below PHI_CACHE_X left after removing the
+      // first a primes, with a running count per word
+      std::vector<uint64_t> cacheWords[PHI_CACHE_PRIMES];
+      std::vector<uint32_t> cacheCounts[PHI_CACHE_PRIMES];
+
+      // y, the largest of the primes phi() removes: cbrt(n) times a factor that grows slowly with n
+      static uint64_t chooseY(uint64_t n)
+      {
+          uint64_t alpha = std::max<uint64_t>(1, (uint64_t) (log((double) std::max<uint64_t>(n, 2)) / 8));
+          return std::max<uint64_t>(std::min(integerRoot(n, 3) * alpha, integerRoot(n, 2)), 1);
+      }
+
+      static uint64_t tableLimit(uint64_t n)
+      {
+          return std::max(n / chooseY(n), integerRoot(n, 2)) + 1;
+      }
+
+      void buildWheel()
+      {
+          const uint32_t wheelPrimes[PHI_WHEEL_PRIMES] = { 2, 3, 5, 7, 11, 13 };
+          phiWheel[0].resize(PHI_WHEEL);
+          for (uint32_t r = 0; r < PHI_WHEEL; r++)
+              phiWheel[0][r] = (uint16_t) r;
+          phiWheelTotal[0] = PHI_WHEEL;
+          for (int k = 1; k <= PHI_WHEEL_PRIMES; k++)
+          {
+              uint32_t p = wheelPrimes[k - 1];
+              phiWheel[k].resize(PHI_WHEEL);
+              for (uint32_t r = 0; r < PHI_WHEEL; r++)
+                  phiWheel[k][r] = (uint16_t) (phiWheel[k - 1][r] - phiWheel[k - 1][r / p]);
+              phiWheelTotal[k] = phiWheelTotal[k - 1] / p * (p - 1);
+          }
+      }
+
+      void buildCache()
+      {
+          size_t cPrimes = std::min(PHI_CACHE_PRIMES, primes.size());
+          std::vector<uint64_t> words(PHI_CACHE_X / 128, ~0ULL);  // Bit i is 2i+1
+          for (size_t a = 1; a < cPrimes; a++)
+          {
+              uint64_t p = primes[a - 1];
+              if (p > 2)
+                  for (uint64_t bit = p >> 1; bit < PHI_CACHE_X / 2; bit += p)
+                      words[bit >> 6] &= ~(1ULL << (bit & 63));
+              if (a <= PHI_WHEEL_PRIMES)
+                  continue;
+
+              cacheWords[a] = words;
+              cacheCounts[a].resize(words.size());
+              uint32_t total = 0;
+              for (size_t w = 0; w < words.size(); w++)
+              {
+                  cacheCounts[a][w] = total;
+                  total += (uint32_t) __builtin_popcountll(words[w]);
+              }
+          }
+      }
+
+      uint64_t phi(uint64_t x, size_t a) const
+      {
+          if (a <= PHI_WHEEL_PRIMES)
+              return (x / PHI_WHEEL) * phiWheelTotal[a] + phiWheel[a][x % PHI_WHEEL];
+          if (x < PHI_CACHE_X && a < PHI_CACHE_PRIMES && !cacheWords[a].empty())
+          {
+              if (x == 0)
+                  return 0;
+              uint64_t bit = (x - 1) >> 1;                      // Last odd number <= x
+              return cacheCounts[a][bit >> 6] + __builtin_popcountll(cacheWords[a][bit >> 6] & (~0ULL >> (63 - (bit & 63))));
+          }
+          if (x < primes[a])
+              return x ? 1 : 0;
+          if (x <= table.maxValue() && x < (uint64_t) primes[a] * primes[a])
+              return table.pi(x) - a + 1;
+
+          uint64_t result = phi(x, PHI_WHEEL_PRIMES);
+          for (size_t i = PHI_WHEEL_PRIMES; i < a; i++)
+          {
+              uint64_t q = x / primes[i];
+              if (q < primes[i])
+              {
+                  // Every remaining p_(i+1) <= x leaves only 1 in x/p, and the ones past x leave nothing
+                  uint64_t cBelow = x <= table.maxValue() ? std::min<uint64_t>(table.pi(x), a) : a;
+                  return result - (cBelow > i ? cBelow - i : 0);
+              }
+              result -= phi(q, i);
+          }
+          return result;
+      }
+
+   public:
+
+      meissel_lehmer(uint64_t limit) : n(limit > 2 ? limit - 1 : 1), table(tableLimit(n))
+      {
+          // The primes up to y and the one after it, which Bertrand's postulate puts below 2y
+          uint64_t y = chooseY(n);
+          table.forEachPrime(2, std::min(2 * y + 1, table.maxValue()), [&](uint64_t p)
+          {
+              if (primes.empty() || primes.back() <= y)
+                  primes.push_back((uint32_t) p);
+          });
+
+          buildWheel();
+          if (n >= PHI_CACHE_MIN_N)
+              buildCache();
+      }
+
+      // What the constructor allocates for a limit, nearly all of it the small_prime_table: a bit per odd
+      // number up to n/y and a count per 512 of them
+      static uint64_t memoryBytes(uint64_t limit)
+      {
+          uint64_t n = limit > 2 ? limit - 1 : 1;
+          uint64_t cWords = ((tableLimit(n) >> 1) + 64) >> 6;
+          return cWords * sizeof(uint64_t) + ((cWords >> 3) + 1) * sizeof(uint32_t);
+      }
+
+      uint64_t count() const
+      {
+          if (n <= table.maxValue())
+              return table.pi(n);
+
+          size_t a = primes.size() - 1;                         // primes[a] is the first prime past y
+          uint64_t y = primes[a - 1];
+          uint64_t result = phi(n, a) + a - 1;
+
+          // P2: for each prime p in (y, sqrt(n)], the q >= p with pq <= n, which is pi(n/p) - pi(p) + 1
+          table.forEachPrime(y + 1, integerRoot(n, 2), [&](uint64_t p)
+          {
+              result -= table.pi(n / p) - table.pi(p) + 1;
+          });
+          return result;
+      }
+};
+
+// primeCount
+//
+// The number of primes below limit, by Meissel-Lehmer.
+
+inline uint64_t primeCount(uint64_t limit)
+{
+    return meissel_lehmer(limit).count();
+}
+
+// cachedPrimeCount
+//
+// primeCount remembered per limit, for validating the same limit pass after pass.
+
+inline uint64_t cachedPrimeCount(uint64_t limit)
+{
+    static std::mutex lock;
+    static std::map<uint64_t, uint64_t> counts;
+
+    std::lock_guard<std::mutex> guard(lock);
+    auto found = counts.find(limit);
+    if (found != counts.end())
+        return found->second;
+    return counts[limit] = primeCount(limit);
+}
@@ -0,0 +1,136 @@
+// ---------------------------------------------------------------------------
+// prime_query.h : Batched primality queries against a finished sieve, with Miller-Rabin past its limit
+// ---------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+#include "bitmap_view.h"
+
+// montgomery64
+//
+// Arithmetic modulo an odd 64-bit n in Montgomery form (a*2^64 mod n), so that a modular multiply is two
+// 64x64->128 multiplies and a subtraction instead of a 128-bit division.
+
+struct montgomery64
+{
+    uint64_t n;
+    uint64_t nInverse;                                          // n^-1 mod 2^64
+    uint64_t r2;                                                // 2^128 mod n
+
+    explicit montgomery64(uint64_t modulus) : n(modulus)
+    {
+        // Newton's iteration doubles the number of correct low bits each step; n is its own inverse mod 8
+        nInverse = n;
+        for (int i = 0; i < 5; i++)
+            nInverse *= 2 - n * nInverse;
+        r2 = (uint64_t) (-(unsigned __int128) n % n);
+    }
+
+    // t / 2^64 mod n, for t < n * 2^64
+    uint64_t reduce(unsigned __int128 t) const
+    {
+        uint64_t m = (uint64_t) t * nInverse;
+        uint64_t hi = (uint64_t) (t >> 64), mn = (uint64_t) (((unsigned __int128) m * n) >> 64);
+        return hi >= mn ? hi - mn : hi - mn + n;
+    }
+
+    uint64_t multiply(uint64_t a, uint64_t b) const
+    {
+        return reduce((unsigned __int128) a * b);
+    }
+
+    uint64_t toMontgomery(uint64_t a) const
+    {
+        return multiply(a % n, r2);
+    }
+
+    uint64_t power(uint64_t base, uint64_t exponent) const
+    {
+        uint64_t result = toMontgomery(1);
+        for (; exponent; exponent >>= 1)
+        {
+            if (exponent & 1)
+                result = multiply(result, base);
+            base = multiply(base, base);
+        }
+        return result;
+    }
+};
+
+// millerRabin
+//
+// Deterministic for every 64-bit n: these seven bases (Jim Sinclair's set) leave no strong pseudoprime
+// below 2^64.  Small factors are tried first, which also takes care of every n where a base is a multiple
+// of n.
+
+inline bool millerRabin(uint64_t n)
+{
+    if (n < 2)
+        return false;
+    for (uint64_t p : { 2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37 })
+        if (n % p == 0)
+            return n == p;
+    if (n < 41 * 41)
+        return true;
+
+    montgomery64 mont(n);
+    uint64_t one = mont.toMontgomery(1), minusOne = mont.toMontgomery(n - 1);
+    int s = __builtin_ctzll(n - 1);
+    uint64_t d = (n - 1) >> s;
+
+    for (uint64_t base : { 2ULL, 325ULL, 9375ULL, 28178ULL, 450775ULL, 9780504ULL, 1795265022ULL })
+    {
+        if (base % n == 0)
+            continue;
+        uint64_t x = mont.power(mont.toMontgomery(base), d);
+        if (x == one || x == minusOne)
+            continue;
+        int r = 1;
+        for (; r < s; r++)
+        {
+            x = mont.multiply(x, x);
+            if (x == minusOne)
+                break;
+        }
+        if (r == s)
+            return false;
+    }
+    return true;
+}
+
+// isPrime
+//
+// One value: from the bitmap when it is below the sieve limit, by Miller-Rabin otherwise.
+
+inline bool isPrime(const bitmap_view &bitmap, uint64_t n)
+{
+    return n < bitmap.limit ? bitmap.isPrime(n) : millerRabin(n);
+}
+
+// queryPrimes
+//
+// Answers cValues queries at once, setting results[i] to 1 when values[i] is prime, and returns how many
+// are.  Random lookups into a bitmap bigger than the cache are cache misses, so the word for the query
+// QUERY_PREFETCH_DISTANCE ahead is prefetched while the current one is answered, keeping several misses in
+// flight.  The queries are answered in input order: bucketing them by bitmap region first was measured to
+// cost more than it saved, since the bucketing pass scatters its writes much as the lookups do.  Values past
+// the sieve go to Miller-Rabin.
+
+const size_t QUERY_PREFETCH_DISTANCE = 16;
+
+inline size_t queryPrimes(const bitmap_view &bitmap, const uint64_t *values, size_t cValues, uint8_t *results)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < cValues; i++)
+    {
+        if (i + QUERY_PREFETCH_DISTANCE < cValues && values[i + QUERY_PREFETCH_DISTANCE] < bitmap.limit)
+            __builtin_prefetch(&bitmap.words[values[i + QUERY_PREFETCH_DISTANCE] >> 7]);
+        uint64_t n = values[i];
+        results[i] = n < bitmap.limit ? bitmap.isPrime(n) : millerRabin(n);
+        count += results[i];
+    }
+    return count;
+}
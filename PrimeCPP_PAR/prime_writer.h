@@ -0,0 +1,233 @@
+// ---------------------------------------------------------------------------
+// prime_writer.h : Buffered, allocation-free output of the primes found
+// ---------------------------------------------------------------------------
+
+#pragma once
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+enum class prime_format { text, u32, u64 };
+
+// prime_output
+//
+// Where --print sends its output and in which format, as chosen on the command line.  Text keeps the
+// "2, 3, 5, " layout of the original printResults; u32/u64 are raw little-endian integers.
+
+struct prime_output
+{
+    std::string path;                                           // Empty or "-" means stdout
+    prime_format format = prime_format::text;
+
+    static prime_output &get()
+    {
+        static prime_output output;
+        return output;
+    }
+
+    static bool parseFormat(const std::string &name, prime_format &format)
+    {
+        if (name == "text")
+            format = prime_format::text;
+        else if (name == "u32")
+            format = prime_format::u32;
+        else if (name == "u64")
+            format = prime_format::u64;
+        else
+            return false;
+        return true;
+    }
+
+    // Whether every prime below hi fits the format
+    bool holds(uint64_t hi) const
+    {
+        return format != prime_format::u32 || hi <= (1ULL << 32);
+    }
+};
+
+// prime_writer
+//
+// Collects primes into a large buffer and hands it to the kernel with big write() calls.  Numbers are
+// formatted with a two-digits-at-a-time itoa rather than iostreams, and putOddBits walks a bitmap a word at a
+// time with count-trailing-zeros, so the cost per prime is a handful of instructions.
+
+class prime_writer
+{
+  protected:
+
+      static const size_t BUFFER_SIZE = 4 << 20;
+      static const size_t MAX_ENTRY   = 24;                     // 20 digits plus the ", " separator
+
+      int fd;
+      bool bOwnsFd;
+      bool bFailed = false;
+      prime_format format;
+      std::vector<char> buffer;
+      size_t used = 0;
+      uint64_t cBytes = 0;
+      uint64_t cPrimes = 0;
+      std::chrono::steady_clock::time_point tStart;
+
+      char *formatText(char *out, uint64_t value)
+      {
+          static const char digitPairs[] =
+              "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+              "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+              "8081828384858687888990919293949596979899";
+          char tmp[20];
+          char *p = tmp + sizeof(tmp);
+          while (value >= 100)
+          {
+              const char *pair = digitPairs + (value % 100) * 2;
+              value /= 100;
+              *--p = pair[1];
+              *--p = pair[0];
+          }
+          if (value >= 10)
+          {
+              *--p = digitPairs[value * 2 + 1];
+              *--p = digitPairs[value * 2];
+          }
+          else
+              *--p = (char) ('0' + value);
+
+          size_t len = tmp + sizeof(tmp) - p;
+          memcpy(out, p, len);
+          out[len]     = ',';
+          out[len + 1] = ' ';
+          return out + len + 2;
+      }
+
+      static char *formatLittleEndian(char *out, uint64_t value, int cBytes)
+      {
+          for (int i = 0; i < cBytes; i++)
+              out[i] = (char) (value >> (8 * i));
+          return out + cBytes;
+      }
+
+   public:
+
+      prime_writer(const prime_output &output = prime_output::get())
+        : format(output.format), buffer(BUFFER_SIZE), tStart(std::chrono::steady_clock::now())
+      {
+          if (output.path.empty() || output.path == "-")
+          {
+              fd = STDOUT_FILENO;
+              bOwnsFd = false;
+          }
+          else
+          {
+              fd = open(output.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+              bOwnsFd = true;
+              if (fd < 0)
+              {
+                  std::cerr << "Cannot open " << output.path << ": " << strerror(errno) << std::endl;
+                  bFailed = true;
+              }
+          }
+          // Anything already sitting in cout must come out before our first write()
+          std::cout.flush();
+      }
+
+      ~prime_writer()
+      {
+          finish();
+          if (bOwnsFd && fd >= 0)
+              close(fd);
+      }
+
+      bool failed() const
+      {
+          return bFailed;
+      }
+
+      void put(uint64_t prime)
+      {
+          if (used + MAX_ENTRY > buffer.size())
+              flush();
+          char *out = &buffer[used];
+          switch (format)
+          {
+              case prime_format::text: out = formatText(out, prime); break;
+              case prime_format::u32:  out = formatLittleEndian(out, prime, 4); break;
+              case prime_format::u64:  out = formatLittleEndian(out, prime, 8); break;
+          }
+          used = out - &buffer[0];
+          cPrimes++;
+      }
+
+      // putOddBits
+      //
+      // Writes 2i+1 for every set bit i in [firstBit, lastBit) of an odd-only bitmap.  For a bitmap that
+      // doesn't start at 1, baseBit is the absolute index of its bit 0.
+
+      void putOddBits(const uint64_t *words, uint64_t firstBit, uint64_t lastBit, uint64_t baseBit = 0)
+      {
+          if (firstBit >= lastBit)
+              return;
+          for (uint64_t w = firstBit >> 6; w <= (lastBit - 1) >> 6; w++)
+          {
+              uint64_t bits = words[w];
+              if (w == firstBit >> 6)
+                  bits &= ~0ULL << (firstBit & 63);
+              if (w == (lastBit - 1) >> 6)
+                  bits &= ~0ULL >> (63 - ((lastBit - 1) & 63));
+              while (bits)
+              {
+                  put(((baseBit + (w << 6) + __builtin_ctzll(bits)) << 1) + 1);
+                  bits &= bits - 1;
+              }
+          }
+      }
+
+      void flush()
+      {
+          const char *p = buffer.data();
+          size_t left = used;
+          while (left && !bFailed)
+          {
+              ssize_t n = write(fd, p, left);
+              if (n < 0)
+              {
+                  if (errno == EINTR)
+                      continue;
+                  std::cerr << "Write failed: " << strerror(errno) << std::endl;
+                  bFailed = true;
+                  break;
+              }
+              p += n;
+              left -= n;
+              cBytes += n;
+          }
+          used = 0;
+      }
+
+      // finish
+      //
+      // Terminates the text line, flushes, and reports the throughput on stderr so it never ends up mixed
+      // into a binary dump.
+
+      void finish()
+      {
+          if (fd < 0)
+              return;
+          if (format == prime_format::text && cPrimes)
+              buffer[used++] = '\n';
+          flush();
+
+          double duration = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+          std::cerr << "Output: " << cPrimes << " primes, " << cBytes / 1e6 << " MB in " << duration << " s, "
+                    << (duration > 0 ? cBytes / 1e6 / duration : 0) << " MB/s" << std::endl;
+          if (bOwnsFd)
+              close(fd);
+          fd = -1;
+      }
+};
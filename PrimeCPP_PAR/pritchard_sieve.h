@@ -0,0 +1,140 @@
+// ---------------------------------------------------------------------------
+// pritchard_sieve.h : Pritchard's wheel sieve on the odd-only word layout
+// ---------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "word_sieve.h"
+
+// prime_sieve_pritchard
+//
+// Pritchard's dynamic wheel sieve.  The bitmap holds W, the numbers up to 'length' coprime to every prime
+// found so far, where length is the product of those primes until it reaches N = limit - 1.  For each new
+// prime p, the smallest member of W past 1:
+//
+//     roll     extend W to min(p * length, N) by repeating it, which is a copy of the bits so far since
+//              length is even and so a whole number of bits
+//     delete   remove p * w for each w in W up to length / p, largest first so that no w is removed
+//              before its own multiple has been
+//
+// until p^2 > N, when W is rolled out to N and holds 1 and the primes above the last p.  Those below go back
+// in at the end.  The wheel only ever holds numbers that are still candidates, so every deletion removes a
+// composite; the rolling is a few passes of word copies over the bitmap.
+
+class prime_sieve_pritchard : public prime_sieve_words
+{
+  protected:
+
+      std::vector<uint32_t> primes;                             // The primes the wheel has been built from
+
+      uint64_t read64(uint64_t bit) const
+      {
+          uint64_t w = bit >> 6, shift = bit & 63;
+          if (!shift)
+              return Words[w];
+          uint64_t bits = Words[w] >> shift;
+          if (w + 1 < cWords)
+              bits |= Words[w + 1] << (64 - shift);
+          return bits;
+      }
+
+      // copyBits
+      //
+      // Copies 'count' bits from src to dst > src, the two ranges not overlapping: bit by bit up to a word
+      // boundary of dst, then a word at a time, merging the last partial word.
+
+      void copyBits(uint64_t src, uint64_t dst, uint64_t count)
+      {
+          for (; count && (dst & 63); count--, src++, dst++)
+          {
+              if (getBit(src))
+                  Words[dst >> 6] |= 1ULL << (dst & 63);
+              else
+                  clearBit(dst);
+          }
+          for (; count >= 64; count -= 64, src += 64, dst += 64)
+              Words[dst >> 6] = read64(src);
+          if (count)
+          {
+              uint64_t mask = (1ULL << count) - 1;
+              Words[dst >> 6] = (Words[dst >> 6] & ~mask) | (read64(src) & mask);
+          }
+      }
+
+      // Repeats bits [0, cOld) up to cNew; cOld is a whole period of the wheel
+      void roll(uint64_t cOld, uint64_t cNew)
+      {
+          for (uint64_t cDone = cOld; cDone < cNew; cDone += std::min(cDone, cNew - cDone))
+              copyBits(0, cDone, std::min(cDone, cNew - cDone));
+      }
+
+      // Removes p * w for every w in W with p * w <= length, scanning the w downwards from length / p
+      void deleteMultiples(uint64_t p, uint64_t length)
+      {
+          uint64_t top = (length / p - 1) >> 1;                 // Bit of the largest odd w <= length / p
+          for (int64_t w = top >> 6; w >= 0; w--)
+          {
+              uint64_t bits = Words[w];
+              if ((uint64_t) w == top >> 6 && (top & 63) != 63)
+                  bits &= (2ULL << (top & 63)) - 1;
+              for (; bits; bits &= ~(1ULL << (63 - __builtin_clzll(bits))))
+              {
+                  uint64_t n = p * ((((uint64_t) w << 6) + 63 - __builtin_clzll(bits)) * 2 + 1);
+                  clearBit(n >> 1);
+              }
+          }
+      }
+
+      // The smallest member of W past 1
+      uint64_t nextPrime() const
+      {
+          uint64_t w = 0, bits = Words[0] & ~1ULL;
+          while (!bits)
+              bits = Words[++w];
+          return (((w << 6) + __builtin_ctzll(bits)) << 1) + 1;
+      }
+
+   public:
+
+      prime_sieve_pritchard(uint64_t n) : prime_sieve_words(n, false)
+      {
+      }
+
+      // runSieve builds the wheel from scratch, so there is nothing to reset
+      void reset()
+      {
+      }
+
+      void runSieve()
+      {
+          if (limit <= 2)
+              return;
+
+          uint64_t N = limit - 1;
+          uint64_t length = 2;                                  // W = {1}, the numbers up to 2 coprime to 2
+          Words[0] = 1;
+          primes.clear();
+
+          // Number 2b + 1 <= n for the bits b below (n + 1) / 2
+          for (uint64_t p = 3; p * p <= N; p = nextPrime())
+          {
+              if (length < N)
+              {
+                  uint64_t newLength = length > N / p ? N : p * length;
+                  roll(length >> 1, (newLength + 1) >> 1);
+                  length = newLength;
+              }
+              deleteMultiples(p, length);
+              primes.push_back((uint32_t) p);
+          }
+
+          if (length < N)
+              roll(length >> 1, cBits);
+          for (uint64_t p : primes)
+              Words[p >> 7] |= 1ULL << ((p >> 1) & 63);
+      }
+};
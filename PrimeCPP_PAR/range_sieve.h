@@ -0,0 +1,223 @@
+// ---------------------------------------------------------------------------
+// range_sieve.h : Cooperative sieve of a window [lo, hi) anywhere in 64-bit space
+// ---------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#include "bitmap_kernels.h"
+#include "page_buffer.h"
+#include "popcount.h"
+#include "presieve.h"
+#include "prime_count.h"
+#include "prime_writer.h"
+#include "sieve_common.h"
+#include "worker_pool.h"
+
+// Windows ending above this are not checked against Meissel-Lehmer, which takes seconds per count there
+const uint64_t RANGE_VALIDATE_MAX = 100'000'000'000'000ULL;
+
+// range_sieve
+//
+// prime_sieve_segmented for a window that need not start at 0: the seed primes up to sqrt(hi) are found once
+// when the sieve is built, and only the odd numbers in [lo, hi) get a bit, so memory grows with hi - lo and
+// sqrt(hi) rather than with hi.  The bitmap starts on a 64-bit word boundary at or below lo, so bit i is
+// the number 2(baseBit + i) + 1 and the presieve tile lines up as it does from 0; the bits below lo and from
+// hi on are kept clear.  2 has no bit and is accounted for separately.  Windows are cache-sized runs of words
+// that the threads claim one at a time, as in prime_sieve_segmented.
+
+class range_sieve
+{
+  protected:
+
+      page_words Words;                                         // Bit i is 2(baseBit + i) + 1
+      std::vector<uint32_t> seedPrimes;                         // Odd primes up to sqrt(hi - 1)
+      uint64_t lo;
+      uint64_t hi;
+      uint64_t baseBit;                                         // Absolute odd-only index of bit 0
+      uint64_t firstBit;                                        // Bit of the first odd number >= lo
+      uint64_t cBits;                                           // Bits below that of the first odd number >= hi
+      uint64_t cWords;
+      uint64_t cSegmentWords;
+      unsigned int cThreads;
+
+      bool includesTwo() const
+      {
+          return lo <= 2 && hi > 2;
+      }
+
+      void computeSeedPrimes()
+      {
+          uint64_t q = hi > 1 ? integerRoot(hi - 1, 2) : 0;
+          seedPrimes.clear();
+          small_prime_table(q).forEachPrime(3, q, [&](uint64_t p) { seedPrimes.push_back((uint32_t) p); });
+      }
+
+      // sieveSegment
+      //
+      // As prime_sieve_segmented::sieveSegment, except that the first multiple of p is the first odd one at or
+      // past both p*p and the start of the segment, found from the absolute bit index.  The small primes'
+      // rotating masks are lined up with the numbers by passing the absolute index of word 0.
+
+      void sieveSegment(uint64_t firstWord, uint64_t lastWord)
+      {
+          uint64_t segmentFirst = std::max(firstWord << 6, firstBit);
+          uint64_t segmentLast  = std::min(lastWord << 6, cBits);
+
+          presieve_pattern::get().fill(&Words[0], firstWord, lastWord, baseBit >> 6);
+          if (firstWord == 0)
+          {
+              Words[0] &= ~0ULL << firstBit;
+              if (baseBit == 0)
+                  Words[0] &= ~1ULL;                            // The number 1
+          }
+          if (lastWord == cWords && (cBits & 63))
+              Words[cWords - 1] &= (1ULL << (cBits & 63)) - 1;
+
+          for (uint32_t p : seedPrimes)
+          {
+              if (p <= presieve_pattern::get().largestPrime())
+                  continue;
+
+              uint64_t num = ((uint64_t) p * p) >> 1;
+              if (num >= baseBit + segmentLast)
+                  break;
+
+              // the multiples of p sit at absolute bit indexes congruent to (p-1)/2 modulo p
+              if (num < baseBit + segmentFirst)
+              {
+                  uint64_t r = (baseBit + segmentFirst - (p >> 1)) % p;
+                  num = baseBit + segmentFirst + (r ? p - r : 0);
+              }
+              if (num < baseBit + segmentLast)
+                  crossOff(&Words[0], p, num - baseBit, segmentLast, baseBit >> 6);
+          }
+      }
+
+   public:
+
+      range_sieve(uint64_t from, uint64_t to, unsigned int threads, size_t segmentBytes = defaultSegmentBytes())
+        : lo(from), hi(std::max(from, to)), cThreads(std::max(1u, threads))
+      {
+          baseBit  = (lo >> 1) & ~63ULL;
+          firstBit = (lo >> 1) - baseBit;
+          cBits    = std::max(hi >> 1, lo >> 1) - baseBit;
+          cWords   = std::max<uint64_t>((cBits + 63) >> 6, 1);
+          Words = allocateWords(cWords, false);
+          Words[0] = 0;
+          cSegmentWords = std::max<uint64_t>(segmentBytes / sizeof(uint64_t), 1);
+          computeSeedPrimes();
+      }
+
+      // reset
+      //
+      // Nothing to do: runSieve fills every segment before sieving it, and the seed primes stay.
+
+      void reset()
+      {
+      }
+
+      void runSieve(worker_pool &pool)
+      {
+          if (cBits <= firstBit)
+              return;
+
+          uint64_t cSegments = (cWords + cSegmentWords - 1) / cSegmentWords;
+          std::atomic<uint64_t> nextSegment(0);
+
+          pool.run([&](unsigned int)
+          {
+              for (uint64_t s; (s = nextSegment.fetch_add(1, std::memory_order_relaxed)) < cSegments; )
+                  sieveSegment(s * cSegmentWords, std::min(cWords, (s + 1) * cSegmentWords));
+          });
+      }
+
+      void runSieve()
+      {
+          worker_pool pool(cThreads);
+          runSieve(pool);
+      }
+
+      // Primes in [lo, hi)
+      size_t countPrimes() const
+      {
+          if (cBits <= firstBit)
+              return includesTwo();
+          return includesTwo() + countBits(&Words[0], firstBit, cBits);
+      }
+
+      // Only numbers inside the window can be answered
+      bool isPrime(uint64_t n) const
+      {
+          if (n == 2)
+              return includesTwo();
+          if (!(n & 1) || n < lo || n >= hi || n == 1)
+              return false;
+          uint64_t bit = (n >> 1) - baseBit;
+          return (Words[bit >> 6] >> (bit & 63)) & 1;
+      }
+
+      // Calls fn with every prime in [lo, hi), in order
+      template <typename F>
+      void forEachPrime(F fn) const
+      {
+          if (includesTwo())
+              fn(2);
+          for (uint64_t w = firstBit >> 6; cBits > firstBit && w <= (cBits - 1) >> 6; w++)
+          {
+              uint64_t bits = Words[w];
+              if (w == firstBit >> 6)
+                  bits &= ~0ULL << (firstBit & 63);
+              if (w == (cBits - 1) >> 6 && (cBits & 63))
+                  bits &= (1ULL << (cBits & 63)) - 1;
+              for (; bits; bits &= bits - 1)
+                  fn(((baseBit + (w << 6) + __builtin_ctzll(bits)) << 1) + 1);
+          }
+      }
+
+      // validateResults
+      //
+      // Checks the count against pi(hi) - pi(lo) from Meissel-Lehmer, for windows that end below
+      // RANGE_VALIDATE_MAX.
+
+      bool validateResults() const
+      {
+          return hi <= RANGE_VALIDATE_MAX && countPrimes() == cachedPrimeCount(hi) - cachedPrimeCount(lo);
+      }
+
+      // printResults
+      //
+      // Same report as prime_sieve_segmented::printResults, with the window in place of the limit.
+
+      void printResults(bool showResults, double duration, size_t passes, size_t threads, double bestPass) const
+      {
+          size_t count = countPrimes();
+
+          if (showResults)
+          {
+              prime_writer writer;
+              if (includesTwo())
+                  writer.put(2);
+              if (cBits > firstBit)
+                  writer.putOddBits(&Words[0], firstBit, cBits, baseBit);
+              writer.finish();
+          }
+
+          std::cout << "Passes: "  << passes << ", "
+                    << "Threads: " << threads << ", "
+                    << "Time: "    << duration << ", "
+                    << "Average: " << duration/passes << ", "
+                    << "Best: "    << bestPass << ", "
+                    << "Per second: " << passes/duration << ", "
+                    << "Range: ["  << lo << ", " << hi << "), "
+                    << "Segment: " << (cSegmentWords * sizeof(uint64_t)) << ", "
+                    << "Count: "   << count << ", "
+                    << "Valid : "  << (hi > RANGE_VALIDATE_MAX ? "unchecked" : validateResults() ? "Pass" : "FAIL!")
+                    << "\n";
+      }
+};
@@ -0,0 +1,234 @@
+// ---------------------------------------------------------------------------
+// segmented_sieve.h : Cooperative segmented sieve - all threads work on one limit
+// ---------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "bitmap_kernels.h"
+#include "bitmap_view.h"
+#include "page_buffer.h"
+#include "perf_profile.h"
+#include "popcount.h"
+#include "presieve.h"
+#include "prime_writer.h"
+#include "sieve_common.h"
+#include "worker_pool.h"
+
+// prime_sieve_segmented
+//
+// Where runSieveThreads gets its parallelism from N independent sieves, this engine splits a single sieve
+// across N threads.  The seed primes up to sqrt(limit) are found once, then the odd-only bitmap is carved
+// into cache-sized segments which the threads claim one at a time and sieve with every seed prime.  Segments
+// are whole 64-bit words, so no two threads ever write to the same word.
+
+class prime_sieve_segmented
+{
+  protected:
+
+      page_words Words;                                         // Sieve data for odd numbers, bit i is 2i+1
+      std::vector<uint32_t> seedPrimes;                         // Odd primes up to sqrt(limit)
+      uint64_t limit;
+      uint64_t cBits;
+      uint64_t cWords;
+      uint64_t cSegmentWords;
+      unsigned int cThreads;
+
+      // computeSeedPrimes
+      //
+      // Small single-threaded odd-only sieve up to sqrt(limit); its output drives every segment.
+
+      void computeSeedPrimes()
+      {
+          uint64_t q = (uint64_t) sqrt((double) limit);
+          while (q * q > limit)
+              q--;
+          while ((q + 1) * (q + 1) <= limit)
+              q++;
+
+          std::vector<bool> small((q >> 1) + 1, true);
+          seedPrimes.clear();
+          for (uint64_t i = 1; i < small.size(); i++)
+          {
+              if (!small[i])
+                  continue;
+              uint64_t p = (i << 1) + 1;
+              seedPrimes.push_back((uint32_t) p);
+              for (uint64_t j = (p * p) >> 1; j < small.size(); j += p)
+                  small[j] = false;
+          }
+      }
+
+      // sieveSegment
+      //
+      // Sets words [firstWord, lastWord) to the pre-sieve pattern and crosses off every remaining seed prime
+      // within them.  Whoever sieves a segment also initializes it, so its pages are first touched by the
+      // thread that uses them.  With --profile the fill and the two kinds of prime are separate phases.
+
+      void sieveSegment(uint64_t firstWord, uint64_t lastWord)
+      {
+          uint64_t firstBit = firstWord << 6;
+          uint64_t lastBit  = std::min(lastWord << 6, cBits);
+
+          profile_phase phase(PHASE_INIT);
+          presieve_pattern::get().fill(&Words[0], firstWord, lastWord);
+          if (lastWord == cWords && (cBits & 63))
+              Words[cWords - 1] &= (1ULL << (cBits & 63)) - 1;
+
+          phase.switchTo(PHASE_SMALL_PRIMES);
+          bool bLargePrimes = false;
+          for (uint32_t p : seedPrimes)
+          {
+              if (p <= presieve_pattern::get().largestPrime())
+                  continue;
+              if (!bLargePrimes && p >= SMALL_STRIDE_LIMIT)
+              {
+                  phase.switchTo(PHASE_LARGE_PRIMES);
+                  bLargePrimes = true;
+              }
+
+              // bit index of p*p, the first multiple we need to cross off
+              uint64_t num = ((uint64_t) p * p) >> 1;
+              if (num >= lastBit)
+                  break;
+
+              // the multiples of p sit at bit indexes congruent to (p-1)/2 modulo p
+              if (num < firstBit)
+              {
+                  uint64_t r = (firstBit - (p >> 1)) % p;
+                  num = firstBit + (r ? p - r : 0);
+              }
+              crossOff(&Words[0], p, num, lastBit);
+          }
+      }
+
+   public:
+
+      prime_sieve_segmented(uint64_t n, unsigned int threads, size_t segmentBytes = defaultSegmentBytes())
+        : limit(n), cBits(n >> 1), cWords((cBits + 63) >> 6), cThreads(std::max(1u, threads))
+      {
+          // Left uninitialized on purpose: each segment is filled by the thread that sieves it, which is also
+          // why the buffer isn't bound to this thread's NUMA node
+          Words = allocateWords(cWords, false);
+          cSegmentWords = std::max<uint64_t>(segmentBytes / sizeof(uint64_t), 1);
+      }
+
+      // reset
+      //
+      // Nothing to do: runSieve fills every segment before sieving it.
+
+      void reset()
+      {
+      }
+
+      // runSieve
+      //
+      // Find the seed primes, then let every worker in the pool pull segments off a shared counter until none
+      // are left.
+
+      void runSieve(worker_pool &pool)
+      {
+          {
+              profile_phase phase(PHASE_SIEVE);
+              computeSeedPrimes();
+          }
+
+          uint64_t cSegments = (cWords + cSegmentWords - 1) / cSegmentWords;
+          std::atomic<uint64_t> nextSegment(0);
+
+          pool.run([&](unsigned int)
+          {
+              for (uint64_t s; (s = nextSegment.fetch_add(1, std::memory_order_relaxed)) < cSegments; )
+                  sieveSegment(s * cSegmentWords, std::min(cWords, (s + 1) * cSegmentWords));
+          });
+      }
+
+      // Without a pool of our own we borrow one for the duration of this sieve
+
+      void runSieve()
+      {
+          worker_pool pool(cThreads);
+          runSieve(pool);
+      }
+
+      // countPrimes
+      //
+      // Bit 0 would be the number 1; we leave it set and let it stand in for 2, so a popcount is the answer.
+
+      size_t countPrimes() const
+      {
+          if (limit <= 2)
+              return 0;
+          return countBits(&Words[0], 0, cBits);
+      }
+
+      // Primes in [lo, hi), for any sub-range of the sieve
+      size_t countPrimes(uint64_t lo, uint64_t hi) const
+      {
+          hi = std::min(hi, limit);
+          if (lo >= hi)
+              return 0;
+          size_t count = (lo <= 2 && hi > 2);
+          return count + countBits(&Words[0], std::max<uint64_t>(lo, 3) >> 1, hi >> 1);
+      }
+
+      bool isPrime(uint64_t n) const
+      {
+          if (n == 2)
+              return limit > 2;
+          if (!(n & 1) || n == 1 || n >= limit)
+              return false;
+          return (Words[n >> 7] >> ((n >> 1) & 63)) & 1;
+      }
+
+      bitmap_view view() const
+      {
+          bitmap_view bitmap;
+          bitmap.words = &Words[0];
+          bitmap.limit = limit;
+          bitmap.cBits = cBits;
+          return bitmap;
+      }
+
+      bool validateResults() const
+      {
+          return validatePrimeCount(limit, countPrimes());
+      }
+
+      // printResults
+      //
+      // Same report as prime_sieve::printResults, plus the wall-clock time of a single cooperative sieve.
+
+      void printResults(bool showResults, double duration, size_t passes, size_t threads, double bestPass) const
+      {
+          size_t count = countPrimes();
+
+          if (showResults)
+          {
+              prime_writer writer;
+              if (limit > 2)
+                  writer.put(2);
+              writer.putOddBits(&Words[0], 1, cBits);
+              writer.finish();
+          }
+
+          std::cout << "Passes: "  << passes << ", "
+                    << "Threads: " << threads << ", "
+                    << "Time: "    << duration << ", "
+                    << "Average: " << duration/passes << ", "
+                    << "Best: "    << bestPass << ", "
+                    << "Per second: " << passes/duration << ", "
+                    << "Limit: "   << limit << ", "
+                    << "Segment: " << (cSegmentWords * sizeof(uint64_t)) << ", "
+                    << "Count: "   << count << ", "
+                    << "Valid : "  << (validatePrimeCount(limit, count) ? "Pass" : "FAIL!")
+                    << "\n";
+      }
+};
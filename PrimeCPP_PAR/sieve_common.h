@@ -0,0 +1,90 @@
+// ---------------------------------------------------------------------------
+// sieve_common.h : Helpers shared by the sieve engines in PrimeCPP_PAR
+// ---------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+#include "cache_info.h"
+#include "prime_count.h"
+
+// KNOWN_PRIME_COUNTS
+//
+// Historical data for validating our results - the number of primes to be found under some limit, such as
+// 168 primes under 1000.  A plain constexpr table so the fixed-limit sieves can check against it at compile
+// time.
+
+struct known_prime_count
+{
+    uint64_t limit;
+    size_t count;
+};
+
+constexpr known_prime_count KNOWN_PRIME_COUNTS[] =
+{
+      {             10LLU, 4         },
+      {            100LLU, 25        },
+      {          1'000LLU, 168       },
+      {         10'000LLU, 1229      },
+      {        100'000LLU, 9592      },
+      {      1'000'000LLU, 78498     },
+      {     10'000'000LLU, 664579    },
+      {    100'000'000LLU, 5761455   },
+      {  1'000'000'000LLU, 50847534  },
+      { 10'000'000'000LLU, 455052511 },
+};
+
+// expectedPrimeCount
+//
+// The known count for a limit, or 0 for limits we have no record of.
+
+constexpr size_t expectedPrimeCount(uint64_t limit)
+{
+    for (const auto &known : KNOWN_PRIME_COUNTS)
+        if (known.limit == limit)
+            return known.count;
+    return 0;
+}
+
+// validatePrimeCount
+//
+// Checks a count produced by any of the engines against the historical data, or for limits not in it, against
+// the Meissel-Lehmer count from prime_count.h, which shares no code with the sieves.
+
+inline bool validatePrimeCount(uint64_t limit, size_t count)
+{
+    size_t expected = expectedPrimeCount(limit);
+    if (expected == 0)
+        return cachedPrimeCount(limit) == count;
+    return expected == count;
+}
+
+// run_options
+//
+// With bReuseSieves the timed runners give every thread one sieve that is reset() between passes, rather
+// than constructing a new one for each pass.  A liveInterval above zero has them report progress and pass
+// latencies that often (in seconds) while they run; see pass_telemetry.h.
+
+struct run_options
+{
+    bool bReuseSieves = false;
+    double liveInterval = 0;
+
+    static run_options &get()
+    {
+        static run_options options;
+        return options;
+    }
+};
+
+// defaultSegmentBytes
+//
+// Size of the per-thread working set for the segmented engines. We aim for the L2 cache so that a segment
+// stays resident while every seed prime walks across it.
+
+inline size_t defaultSegmentBytes()
+{
+    return cacheSizeBytes(2);
+}
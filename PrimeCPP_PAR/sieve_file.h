@@ -0,0 +1,227 @@
+// ---------------------------------------------------------------------------
+// sieve_file.h : Versioned on-disk sieve bitmap, mapped read-only for zero-copy startup
+// ---------------------------------------------------------------------------
+
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "bitmap_view.h"
+
+// sieve_file_header
+//
+// The first page of a sieve file.  The words follow at SIEVE_FILE_DATA_OFFSET so that they are page aligned
+// in the mapping.  'wheel' names the bitmap layout: 2 is the odd-only layout of bitmap_view, the only one
+// written so far; other values are reserved for wheel-factorized bitmaps.  The checksum is FNV-1a over the
+// words, so a truncated or damaged file is caught by --verify.  All fields are little-endian, as written by
+// the x86 machines this runs on.
+
+const char     SIEVE_FILE_MAGIC[8]    = { 'P', 'R', 'I', 'M', 'E', 'S', 'V', '\0' };
+const uint32_t SIEVE_FILE_VERSION     = 1;
+const uint64_t SIEVE_FILE_DATA_OFFSET = 4096;
+
+struct sieve_file_header
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t wheel;
+    uint64_t limit;
+    uint64_t cBits;
+    uint64_t cWords;
+    uint64_t count;                                             // Primes below limit, for a quick sanity check
+    uint64_t checksum;
+};
+
+inline uint64_t checksumWords(const uint64_t *words, uint64_t cWords)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (uint64_t w = 0; w < cWords; w++)
+        hash = (hash ^ words[w]) * 0x100000001b3ULL;
+    return hash;
+}
+
+// saveSieveFile
+//
+// Writes the header and words to a temporary file next to 'path' and renames it into place, so a process
+// mapping the old file never sees a half-written one.  Sieve files are Linux-only, like the mapping.
+
+inline bool saveSieveFile(const std::string &path, const bitmap_view &bitmap)
+{
+#if defined(__linux__)
+    sieve_file_header header = {};
+    memcpy(header.magic, SIEVE_FILE_MAGIC, sizeof(header.magic));
+    header.version  = SIEVE_FILE_VERSION;
+    header.wheel    = 2;
+    header.limit    = bitmap.limit;
+    header.cBits    = bitmap.cBits;
+    header.cWords   = bitmap.cWords();
+    header.count    = bitmap.countPrimes();
+    header.checksum = checksumWords(bitmap.words, header.cWords);
+
+    std::string tmpPath = path + ".tmp";
+    int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        std::cerr << "Cannot create " << tmpPath << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    char firstPage[SIEVE_FILE_DATA_OFFSET] = {};
+    memcpy(firstPage, &header, sizeof(header));
+
+    auto writeAll = [fd](const char *p, size_t left)
+    {
+        while (left)
+        {
+            ssize_t n = write(fd, p, std::min<size_t>(left, 1 << 30));
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+            p += n;
+            left -= n;
+        }
+        return true;
+    };
+
+    bool bOk = writeAll(firstPage, sizeof(firstPage))
+            && writeAll((const char *) bitmap.words, header.cWords * sizeof(uint64_t))
+            && fsync(fd) == 0;
+    if (!bOk)
+        std::cerr << "Cannot write " << tmpPath << ": " << strerror(errno) << std::endl;
+    close(fd);
+
+    if (bOk && rename(tmpPath.c_str(), path.c_str()) != 0)
+    {
+        std::cerr << "Cannot rename " << tmpPath << " to " << path << ": " << strerror(errno) << std::endl;
+        bOk = false;
+    }
+    if (!bOk)
+        unlink(tmpPath.c_str());
+    return bOk;
+#else
+    (void) bitmap;
+    std::cerr << "Cannot create " << path << ": sieve files are not supported on this platform" << std::endl;
+    return false;
+#endif
+}
+
+// mapped_sieve
+//
+// A sieve file mapped read-only and shared, so every process that opens it uses the same page-cache copy.
+// Opening only checks the header against the file size; nothing is read or copied, and pages come in as the
+// queries touch them.  verify() reads everything once to check the checksum and the stored count.
+
+class mapped_sieve
+{
+  protected:
+
+      const char *base = nullptr;
+      size_t length = 0;
+      sieve_file_header header = {};
+      std::string error;
+
+   public:
+
+      mapped_sieve(const std::string &path)
+      {
+#if defined(__linux__)
+          int fd = open(path.c_str(), O_RDONLY);
+          if (fd < 0)
+          {
+              error = std::string("cannot open: ") + strerror(errno);
+              return;
+          }
+
+          struct stat st;
+          if (fstat(fd, &st) != 0 || (size_t) st.st_size < SIEVE_FILE_DATA_OFFSET)
+          {
+              error = "file too short for a sieve header";
+              close(fd);
+              return;
+          }
+
+          length = st.st_size;
+          void *p = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+          close(fd);
+          if (p == MAP_FAILED)
+          {
+              error = std::string("cannot map: ") + strerror(errno);
+              length = 0;
+              return;
+          }
+          base = (const char *) p;
+          memcpy(&header, base, sizeof(header));
+
+          if (memcmp(header.magic, SIEVE_FILE_MAGIC, sizeof(header.magic)) != 0)
+              error = "not a sieve file";
+          else if (header.version != SIEVE_FILE_VERSION)
+              error = "unsupported version " + std::to_string(header.version);
+          else if (header.wheel != 2)
+              error = "unsupported wheel " + std::to_string(header.wheel);
+          else if (header.cBits != header.limit >> 1 || header.cWords != (header.cBits + 63) >> 6
+                   || length < SIEVE_FILE_DATA_OFFSET + header.cWords * sizeof(uint64_t))
+              error = "header does not match the file size";
+#else
+          (void) path;
+          error = "sieve files are not supported on this platform";
+#endif
+      }
+
+      ~mapped_sieve()
+      {
+#if defined(__linux__)
+          if (base)
+              munmap((void *) base, length);
+#endif
+      }
+
+      mapped_sieve(const mapped_sieve &) = delete;
+      mapped_sieve &operator=(const mapped_sieve &) = delete;
+
+      bool ok() const
+      {
+          return error.empty();
+      }
+
+      const std::string &lastError() const
+      {
+          return error;
+      }
+
+      const sieve_file_header &info() const
+      {
+          return header;
+      }
+
+      bitmap_view view() const
+      {
+          bitmap_view bitmap;
+          if (!ok())
+              return bitmap;
+          bitmap.words = (const uint64_t *) (base + SIEVE_FILE_DATA_OFFSET);
+          bitmap.limit = header.limit;
+          bitmap.cBits = header.cBits;
+          return bitmap;
+      }
+
+      bool verify() const
+      {
+          if (!ok())
+              return false;
+          bitmap_view bitmap = view();
+          return checksumWords(bitmap.words, header.cWords) == header.checksum
+              && bitmap.countPrimes() == header.count;
+      }
+};
@@ -0,0 +1,129 @@
+// ---------------------------------------------------------------------------
+// tune_config.h : Engine configurations found by --tune, and the file they persist in
+// ---------------------------------------------------------------------------
+
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+const char DEFAULT_TUNE_FILE[] = "primes_par.tune";
+
+// tuned_config
+//
+// One engine setup: which engine, on how many threads, with which segment size and thread placement.  The
+// segment is a tranche size in bits for the tranche engine and a segment size in bytes for the cooperative
+// one; 0 means the engine's own default.
+
+struct tuned_config
+{
+    uint64_t limit = 0;
+    std::string engine;                                         // basic, words, wheel<W>, tranches, cooperative
+    unsigned int threads = 1;
+    uint64_t segment = 0;
+    std::string affinity = "none";
+    double passesPerSecond = 0;
+
+    std::string describe() const
+    {
+        std::ostringstream out;
+        out << "engine=" << engine << " threads=" << threads << " segment=" << segment << " affinity=" << affinity;
+        return out.str();
+    }
+
+    // One line of the tune file: limit=... engine=... threads=... segment=... affinity=... passes=...
+    std::string toLine() const
+    {
+        std::ostringstream out;
+        out << "limit=" << limit << " " << describe() << " passes=" << passesPerSecond;
+        return out.str();
+    }
+
+    static bool fromLine(const std::string &line, tuned_config &config)
+    {
+        if (line.empty() || line[0] == '#')
+            return false;
+
+        std::istringstream in(line);
+        std::string field;
+        while (in >> field)
+        {
+            auto eq = field.find('=');
+            if (eq == std::string::npos)
+                return false;
+            std::string key = field.substr(0, eq), value = field.substr(eq + 1);
+            if (key == "limit")
+                config.limit = strtoull(value.c_str(), nullptr, 10);
+            else if (key == "engine")
+                config.engine = value;
+            else if (key == "threads")
+                config.threads = (unsigned int) atoi(value.c_str());
+            else if (key == "segment")
+                config.segment = strtoull(value.c_str(), nullptr, 10);
+            else if (key == "affinity")
+                config.affinity = value;
+            else if (key == "passes")
+                config.passesPerSecond = atof(value.c_str());
+        }
+        return config.limit != 0 && !config.engine.empty() && config.threads != 0;
+    }
+};
+
+inline std::vector<tuned_config> loadTuneFile(const std::string &path)
+{
+    std::vector<tuned_config> configs;
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line))
+    {
+        tuned_config config;
+        if (tuned_config::fromLine(line, config))
+            configs.push_back(config);
+    }
+    return configs;
+}
+
+// saveTunedConfig
+//
+// Adds the configuration to the tune file, replacing whatever was recorded for the same limit before.
+
+inline bool saveTunedConfig(const std::string &path, const tuned_config &config)
+{
+    std::vector<tuned_config> configs = loadTuneFile(path);
+    std::ofstream out(path, std::ios::trunc);
+    if (!out)
+        return false;
+
+    out << "# primes_par --tune results, one line per limit" << std::endl;
+    for (const auto &existing : configs)
+        if (existing.limit != config.limit)
+            out << existing.toLine() << std::endl;
+    out << config.toLine() << std::endl;
+    return (bool) out;
+}
+
+// findTunedConfig
+//
+// The entry for this limit, or failing that the one whose limit is closest on a log scale.
+
+inline bool findTunedConfig(const std::string &path, uint64_t limit, tuned_config &config)
+{
+    double best = 0;
+    bool bFound = false;
+    for (const auto &candidate : loadTuneFile(path))
+    {
+        double distance = fabs(log((double) candidate.limit) - log((double) limit));
+        if (!bFound || distance < best)
+        {
+            config = candidate;
+            best = distance;
+            bFound = true;
+        }
+    }
+    return bFound;
+}
@@ -0,0 +1,244 @@
+// ---------------------------------------------------------------------------
+// wheel_sieve.h : Wheel-factorized sieve, templated on the wheel size
+// ---------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+
+#include "bitmap_kernels.h"
+#include "page_buffer.h"
+#include "popcount.h"
+#include "prime_writer.h"
+#include "sieve_common.h"
+
+constexpr uint32_t wheelGcd(uint32_t a, uint32_t b)
+{
+    return b ? wheelGcd(b, a % b) : a;
+}
+
+constexpr uint32_t wheelPhi(uint32_t W)
+{
+    uint32_t phi = 0;
+    for (uint32_t r = 0; r < W; r++)
+        if (wheelGcd(r, W) == 1)
+            phi++;
+    return phi;
+}
+
+// wheel_layout
+//
+// Compile-time tables for a wheel of circumference W (2, 6, 30, 210, ...).  Only numbers coprime to W get a
+// bit: number n lives at index (n / W) * phi + rank[n % W], so a 30-wheel stores 8 residues per 30 numbers
+// (one byte) and a 210-wheel 48 per 210.  The primes dividing W are never stored and are accounted for
+// separately.
+
+template <uint32_t W>
+struct wheel_layout
+{
+    static constexpr uint32_t phi = wheelPhi(W);
+
+    struct tables
+    {
+        std::array<uint32_t, phi> residues;                     // The residues coprime to W, ascending
+        std::array<int32_t, W> rank;                            // Index of each residue, -1 if not coprime
+        std::array<uint32_t, 8> primes;                         // The primes dividing W
+        uint32_t cPrimes;
+
+        constexpr tables() : residues{}, rank{}, primes{}, cPrimes(0)
+        {
+            uint32_t n = 0;
+            for (uint32_t r = 0; r < W; r++)
+            {
+                rank[r] = -1;
+                if (wheelGcd(r, W) == 1)
+                {
+                    rank[r] = (int32_t) n;
+                    residues[n++] = r;
+                }
+            }
+            uint32_t rest = W;
+            for (uint32_t p = 2; p <= rest; p++)
+            {
+                if (rest % p == 0)
+                {
+                    primes[cPrimes++] = p;
+                    while (rest % p == 0)
+                        rest /= p;
+                }
+            }
+        }
+    };
+
+    static constexpr tables t = tables();
+
+    static uint64_t index(uint64_t n)
+    {
+        return (n / W) * phi + t.rank[n % W];
+    }
+
+    static uint64_t number(uint64_t i)
+    {
+        return (i / phi) * W + t.residues[i % phi];
+    }
+};
+
+// prime_sieve_wheel
+//
+// Same surface as prime_sieve, built on a wheel_layout.  For every sieving prime p we cross off p*m for all
+// m >= p coprime to W: each of the phi residue classes of m gives an arithmetic progression with a stride of
+// p*phi bits, which the word kernels handle like any other stride.  With W == 2 this is exactly the odd-only
+// layout of prime_sieve_words.
+
+template <uint32_t W>
+class prime_sieve_wheel
+{
+  protected:
+
+      typedef wheel_layout<W> layout;
+
+      page_words Words;                                         // Sieve data, where 1==prime, 0==not
+      uint64_t limit;
+      uint64_t cBits;
+      uint64_t cWords;
+
+      bool getBit(uint64_t num) const
+      {
+          return (Words[num >> 6] >> (num & 63)) & 1;
+      }
+
+      size_t wheelPrimesBelowLimit() const
+      {
+          size_t count = 0;
+          for (uint32_t i = 0; i < layout::t.cPrimes; i++)
+              if (layout::t.primes[i] < limit)
+                  count++;
+          return count;
+      }
+
+   public:
+
+      static_assert(W >= 2, "a wheel needs a circumference of at least 2");
+
+      prime_sieve_wheel(uint64_t n) : limit(n)
+      {
+          // Number of values below n that are coprime to W
+          cBits = (n / W) * layout::phi;
+          for (uint32_t j = 0; j < layout::phi && layout::t.residues[j] < n % W; j++)
+              cBits++;
+          cWords = (cBits + 63) >> 6;
+
+          Words = allocateWords(cWords);
+          reset();
+      }
+
+      // reset
+      //
+      // Back to the state the constructor left it in, so the same buffer can be sieved again.
+
+      void reset()
+      {
+          std::fill(&Words[0], &Words[0] + cWords, ~0ULL);     // Initialize all to true (potential primes)
+          if (cBits & 63)
+              Words[cWords - 1] = (1ULL << (cBits & 63)) - 1;
+          if (cBits)
+              Words[0] &= ~1ULL;                                 // 1 is not a prime
+      }
+
+      // runSieve
+      //
+      // Scan for the next surviving number p, then cross off p*m for the phi residue classes of m.
+
+      void runSieve()
+      {
+          for (uint64_t factor = 1; factor < cBits; factor++)
+          {
+              uint64_t w = factor >> 6;
+              uint64_t bits = Words[w] & (~0ULL << (factor & 63));
+              while (!bits && ++w < cWords)
+                  bits = Words[w];
+              if (!bits)
+                  break;
+              factor = (w << 6) + __builtin_ctzll(bits);
+
+              uint64_t p = layout::number(factor);
+              if (p * p >= limit)
+                  break;
+
+              for (uint32_t j = 0; j < layout::phi; j++)
+              {
+                  // smallest m >= p in residue class j
+                  uint64_t m = p + (layout::t.residues[j] + W - p % W) % W;
+                  uint64_t first = layout::index(p * m);
+                  if (W == 2)
+                      crossOff(&Words[0], p, first, cBits);
+                  else
+                      crossOffLarge(&Words[0], p * layout::phi, first, cBits);
+              }
+          }
+      }
+
+      // countPrimes
+      //
+      // Can be called after runSieve to determine how many primes were found in total
+
+      size_t countPrimes() const
+      {
+          return wheelPrimesBelowLimit() + countBits(&Words[0], 0, cBits);
+      }
+
+      bool isPrime(uint64_t n) const
+      {
+          if (n >= limit)
+              return false;
+          if (layout::t.rank[n % W] < 0)
+          {
+              for (uint32_t i = 0; i < layout::t.cPrimes; i++)
+                  if (layout::t.primes[i] == n)
+                      return true;
+              return false;
+          }
+          return getBit(layout::index(n));
+      }
+
+      bool validateResults() const
+      {
+          return validatePrimeCount(limit, countPrimes());
+      }
+
+      // printResults
+      //
+      // Displays stats about what was found as well as (optionally) the primes themselves
+
+      void printResults(bool showResults, double duration, size_t passes, size_t threads) const
+      {
+          size_t count = countPrimes();
+
+          if (showResults)
+          {
+              prime_writer writer;
+              for (uint32_t i = 0; i < layout::t.cPrimes; i++)
+                  if (layout::t.primes[i] < limit)
+                      writer.put(layout::t.primes[i]);
+              for (uint64_t w = 0; w < cWords; w++)
+                  for (uint64_t bits = Words[w]; bits; bits &= bits - 1)
+                      writer.put(layout::number((w << 6) + __builtin_ctzll(bits)));
+              writer.finish();
+          }
+
+          std::cout << "Passes: "  << passes << ", "
+                    << "Threads: " << threads << ", "
+                    << "Time: "    << duration << ", "
+                    << "Average: " << duration/passes << ", "
+                    << "Per second: " << passes/duration << ", "
+                    << "Limit: "   << limit << ", "
+                    << "Wheel: "   << W << ", "
+                    << "Count: "   << count << ", "
+                    << "Valid : "  << (validatePrimeCount(limit, count) ? "Pass" : "FAIL!")
+                    << "\n";
+      }
+};
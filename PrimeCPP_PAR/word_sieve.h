@@ -0,0 +1,188 @@
+// ---------------------------------------------------------------------------
+// word_sieve.h : Odd-only sieve stored in raw 64-bit words instead of vector<bool>
+// ---------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+
+#include "bitmap_kernels.h"
+#include "bitmap_view.h"
+#include "page_buffer.h"
+#include "perf_profile.h"
+#include "popcount.h"
+#include "presieve.h"
+#include "prime_writer.h"
+#include "sieve_common.h"
+
+// prime_sieve_words
+//
+// Same sieve as prime_sieve, but the bits live in plain uint64_t words so the cross-off loops can use the
+// kernels from bitmap_kernels.h rather than going through vector<bool>'s proxy references.  Bit i stands
+// for 2i+1; bit 0 (the number 1) is left set and stands in for 2, so counting is a plain popcount.
+
+class prime_sieve_words
+{
+  protected:
+
+      page_words Words;                                         // Sieve data, where 1==prime, 0==not
+      uint64_t limit;
+      uint64_t cBits;
+      uint64_t cWords;
+
+      bool getBit(uint64_t num) const
+      {
+          return (Words[num >> 6] >> (num & 63)) & 1;
+      }
+
+      void clearBit(uint64_t num)
+      {
+          Words[num >> 6] &= ~(1ULL << (num & 63));
+      }
+
+      // Lets a derived engine leave the initialization to its own runSieve, a piece at a time
+      prime_sieve_words(uint64_t n, bool bInitialize) : limit(n), cBits(n >> 1), cWords((cBits + 63) >> 6)
+      {
+          Words = allocateWords(cWords);
+          if (bInitialize)
+              initializeWords(0, cWords);
+      }
+
+      // initializeWords
+      //
+      // All true, bar the pre-sieved small primes, and nothing past the last bit.
+
+      void initializeWords(uint64_t firstWord, uint64_t lastWord)
+      {
+          presieve_pattern::get().fill(&Words[0], firstWord, lastWord);
+          if (lastWord == cWords && (cBits & 63))
+              Words[cWords - 1] &= (1ULL << (cBits & 63)) - 1;
+      }
+
+   public:
+
+      prime_sieve_words(uint64_t n) : prime_sieve_words(n, true)
+      {
+      }
+
+      // reset
+      //
+      // Back to the state the constructor left it in, so the same buffer can be sieved again.
+
+      void reset()
+      {
+          initializeWords(0, cWords);
+      }
+
+      // runSieve
+      //
+      // Find the next set bit with a count-trailing-zeros scan, then hand its multiples to the kernel that
+      // suits its stride.  The primes already in the pre-sieve pattern are skipped.  With --profile the
+      // primes below SMALL_STRIDE_LIMIT and the rest are reported as separate phases.
+
+      void runSieve()
+      {
+          uint64_t factor = presieve_pattern::get().firstSievingBit();
+          profile_phase phase(PHASE_SMALL_PRIMES);
+          bool bLargePrimes = false;
+
+          while (factor < cBits)
+          {
+              uint64_t w = factor >> 6;
+              uint64_t bits = Words[w] & (~0ULL << (factor & 63));
+              while (!bits && ++w < cWords)
+                  bits = Words[w];
+              if (!bits)
+                  break;
+              factor = (w << 6) + __builtin_ctzll(bits);
+
+              uint64_t p = (factor << 1) + 1;
+              uint64_t first = 2 * factor * (factor + 1);       // bit index of p*p, see prime_sieve::runSieve
+              if (first >= cBits)
+                  break;
+              if (!bLargePrimes && p >= SMALL_STRIDE_LIMIT)
+              {
+                  phase.switchTo(PHASE_LARGE_PRIMES);
+                  bLargePrimes = true;
+              }
+              crossOff(&Words[0], p, first, cBits);
+
+              factor++;
+          }
+      }
+
+      // countPrimes
+      //
+      // Can be called after runSieve to determine how many primes were found in total
+
+      size_t countPrimes() const
+      {
+          if (limit <= 2)
+              return 0;
+          return countBits(&Words[0], 0, cBits);
+      }
+
+      // Primes in [lo, hi), for any sub-range of the sieve
+      size_t countPrimes(uint64_t lo, uint64_t hi) const
+      {
+          hi = std::min(hi, limit);
+          if (lo >= hi)
+              return 0;
+          size_t count = (lo <= 2 && hi > 2);
+          return count + countBits(&Words[0], std::max<uint64_t>(lo, 3) >> 1, hi >> 1);
+      }
+
+      bool isPrime(uint64_t n) const
+      {
+          if (n == 2)
+              return limit > 2;
+          if (!(n & 1) || n == 1 || n >= limit)
+              return false;
+          return getBit(n >> 1);
+      }
+
+      bitmap_view view() const
+      {
+          bitmap_view bitmap;
+          bitmap.words = &Words[0];
+          bitmap.limit = limit;
+          bitmap.cBits = cBits;
+          return bitmap;
+      }
+
+      bool validateResults() const
+      {
+          return validatePrimeCount(limit, countPrimes());
+      }
+
+      // printResults
+      //
+      // Displays stats about what was found as well as (optionally) the primes themselves
+
+      void printResults(bool showResults, double duration, size_t passes, size_t threads) const
+      {
+          size_t count = countPrimes();
+
+          if (showResults)
+          {
+              prime_writer writer;
+              if (limit > 2)
+                  writer.put(2);
+              writer.putOddBits(&Words[0], 1, cBits);
+              writer.finish();
+          }
+
+          std::cout << "Passes: "  << passes << ", "
+                    << "Threads: " << threads << ", "
+                    << "Time: "    << duration << ", "
+                    << "Average: " << duration/passes << ", "
+                    << "Per second: " << passes/duration << ", "
+                    << "Limit: "   << limit << ", "
+                    << "Count: "   << count << ", "
+                    << "Valid : "  << (validatePrimeCount(limit, count) ? "Pass" : "FAIL!")
+                    << "\n";
+      }
+};
@@ -0,0 +1,187 @@
+// ---------------------------------------------------------------------------
+// worker_pool.h : Long-lived worker threads released and collected by a cheap barrier
+// ---------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "cpu_topology.h"
+
+// spinWaitWhile
+//
+// Waits for an atomic to change away from 'value'.  We spin for a short while first, since the other side is
+// usually only microseconds away, and only then park the thread in the kernel (futex) so idle workers don't
+// burn a core.  Returns the new value.
+
+inline uint32_t spinWaitWhile(std::atomic<uint32_t> &word, uint32_t value)
+{
+    for (int spin = 0; spin < 4096; spin++)
+    {
+        uint32_t current = word.load(std::memory_order_acquire);
+        if (current != value)
+            return current;
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+
+    uint32_t current;
+    while ((current = word.load(std::memory_order_acquire)) == value)
+    {
+#if defined(__linux__)
+        syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAIT_PRIVATE, value, nullptr, nullptr, 0);
+#else
+        std::this_thread::yield();
+#endif
+    }
+    return current;
+}
+
+inline void wakeAll(std::atomic<uint32_t> &word)
+{
+#if defined(__linux__)
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr, 0);
+#endif
+}
+
+// worker_pool
+//
+// Creates its threads once (and pins them once, if asked to) and then hands them one job after another.
+// start() releases every worker on a job, which is called with the worker's index; wait() is the barrier
+// that returns once they have all finished it.  Between jobs the workers sit in spinWaitWhile.
+
+class worker_pool
+{
+  protected:
+
+      std::vector<std::thread> threads;
+      std::function<void(unsigned int)> job;
+      std::atomic<uint32_t> generation;                         // Bumped once per job to release the workers
+      std::atomic<uint32_t> pending;                            // Workers still busy with the current job
+      bool bShutdown = false;
+      affinity_policy policy;
+
+      void workerLoop(unsigned int index)
+      {
+          uint32_t seen = 0;
+          for (;;)
+          {
+              seen = spinWaitWhile(generation, seen);
+              if (bShutdown)
+                  return;
+              job(index);
+              if (pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                  wakeAll(pending);
+          }
+      }
+
+      std::vector<int> placement;                               // CPU each worker is pinned to, or -1
+
+      void pinThread(unsigned int i, const std::vector<unsigned int> &order)
+      {
+          placement.push_back(-1);
+          if (order.empty())
+              return;
+          unsigned int cpu = order[i % order.size()];
+#if defined(__linux__)
+          cpu_set_t cpuset;
+          CPU_ZERO(&cpuset);
+          CPU_SET(cpu, &cpuset);
+          int rc = pthread_setaffinity_np(threads.back().native_handle(), sizeof(cpu_set_t), &cpuset);
+          if(rc != 0) {
+              std::cerr << "Error setting thread affinity on thread " << i << " to cpu " << cpu << ", error code: " << rc << std::endl;
+              return;
+          }
+          placement.back() = (int) cpu;
+#endif
+      }
+
+   public:
+
+      worker_pool(unsigned int cThreads, const cpu_affinity &affinity = defaultAffinity())
+        : generation(0), pending(0), policy(affinity.policy)
+      {
+          std::vector<unsigned int> order = affinity.order();
+          for (unsigned int i = 0; i < cThreads; i++)
+          {
+              threads.push_back(std::thread([this, i] { workerLoop(i); }));
+              pinThread(i, order);
+          }
+      }
+
+      ~worker_pool()
+      {
+          bShutdown = true;
+          generation.fetch_add(1, std::memory_order_release);
+          wakeAll(generation);
+          for (auto &th : threads)
+              th.join();
+      }
+
+      unsigned int size() const
+      {
+          return (unsigned int) threads.size();
+      }
+
+      // describePlacement
+      //
+      // "scatter: 0,2,1,3" - the policy and the CPU of each worker in order, "-" for one left unpinned.
+
+      std::string describePlacement() const
+      {
+          std::string text = policy == affinity_policy::list ? "list" : affinityName(cpu_affinity{ policy, {} });
+          text += ":";
+          for (size_t i = 0; i < placement.size(); i++)
+              text += (i ? "," : " ") + (placement[i] < 0 ? std::string("-") : std::to_string(placement[i]));
+          return text;
+      }
+
+      bool pinned() const
+      {
+          return policy != affinity_policy::none;
+      }
+
+      // start
+      //
+      // Releases all workers on fn.  The previous job must have been collected with wait().
+
+      void start(std::function<void(unsigned int)> fn)
+      {
+          job = std::move(fn);
+          pending.store(size(), std::memory_order_relaxed);
+          generation.fetch_add(1, std::memory_order_release);
+          wakeAll(generation);
+      }
+
+      // wait
+      //
+      // Barrier: returns once every worker has finished the job handed out by start().
+
+      void wait()
+      {
+          uint32_t left;
+          while ((left = pending.load(std::memory_order_acquire)) != 0)
+              spinWaitWhile(pending, left);
+      }
+
+      void run(std::function<void(unsigned int)> fn)
+      {
+          start(std::move(fn));
+          wait();
+      }
+};